@@ -3,7 +3,17 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
+
+// Build with -D FASTIOT_MQTT5 to use the built-in MQTT 5 client instead of PubSubClient
+#if defined(FASTIOT_MQTT5)
+#include "FastIoTMqtt5.h"
+typedef FastIoTMqtt5 MqttTransport;
+#define FASTIOT_PUBLISH_PROPERTIES_SIZE FASTIOT_MQTT5_PUBLISH_PROPERTIES_SIZE
+#else
 #include <PubSubClient.h>
+typedef PubSubClient MqttTransport;
+#define FASTIOT_PUBLISH_PROPERTIES_SIZE 0
+#endif
 
 #if defined(ESP8266)
 #include <ESP8266WiFi.h>
@@ -11,12 +21,42 @@
 #include <WiFi.h>
 #endif
 
+// Upper bound on edge rules accepted in one rule set
+#ifndef FASTIOT_MAX_RULES
+#define FASTIOT_MAX_RULES 32
+#endif
+
+// Upper bound on panes per sliding aggregation window (window length / slide)
+#ifndef FASTIOT_MAX_WINDOW_PANES
+#define FASTIOT_MAX_WINDOW_PANES 6
+#endif
+
+// Centroids kept per pane for aggregation percentiles; panes with fewer samples are exact
+#ifndef FASTIOT_AGGREGATE_CENTROIDS
+#define FASTIOT_AGGREGATE_CENTROIDS 16
+#endif
+
+// Closed-window summaries kept per channel while they cannot be published
+#ifndef FASTIOT_AGGREGATE_BACKLOG
+#define FASTIOT_AGGREGATE_BACKLOG 4
+#endif
+
 struct ChannelUpdate
 {
     String name;
     JsonVariant value;
 };
 
+enum PublishResult
+{
+    PUBLISH_OK,
+    PUBLISH_WOULD_BLOCK,   // TCP send buffer cannot take the packet right now
+    PUBLISH_RATE_LIMITED,  // Message or byte budget exhausted, retry later
+    PUBLISH_TOO_LARGE,     // Packet exceeds the MQTT buffer size (non-blocking only)
+    PUBLISH_NOT_CONNECTED,
+    PUBLISH_FAILED
+};
+
 class FastIoT
 {
 public:
@@ -31,16 +71,51 @@ public:
     void disconnect();
     bool isConnected();
 
+#if defined(FASTIOT_MQTT5)
+    // Call before connectMQTT()
+    void setSessionExpiry(uint32_t seconds);
+    void setReceiveMaximum(uint16_t count);
+#endif
+
     void setCallback(void (*callback)(String topic, String message));
     void onChannelChange(String name, void (*callback)(String name, JsonVariant value));
     void removeChannelCallback(String name);
 
+    // Inbound payloads larger than the MQTT packet buffer are streamed through a fixed window.
+    // Call before connectMQTT(): under MQTT 5 the CONNECT otherwise caps packets at the buffer size.
+    void enableStreamingReceive(size_t windowSize = 0);
+    void setPayloadSink(void (*sink)(const uint8_t *chunk, size_t length, size_t offset, bool last));
+
+    // Edge rules: local channel-to-channel reactions, also accepted as {"rules": [...]} on the device topic
+    bool setRules(String rules);
+    void clearRules();
+    size_t getRuleCount();
+
     bool publishChannelUpdate(String name, bool channelValue);
     bool publishChannelUpdate(String name, int channelValue);
     bool publishChannelUpdate(String name, float channelValue);
     bool publishChannelUpdate(String name, String channelValue);
     bool publishChannelUpdates(ChannelUpdate updates[], size_t count);
     bool updateLocation(float latitude, float longitude);
+
+    // Buffer fixes and upload them as delta-encoded tracks (capacity 0 publishes every fix)
+    void setLocationBuffering(size_t capacity, unsigned long uploadInterval, float minDistance = 5.0, float minHeadingChange = 10.0);
+    bool flushLocationTrack();
+
+    // Summarise numeric channels locally and publish one summary per window (slide 0 = tumbling)
+    bool aggregateChannel(String name, unsigned long windowLength, unsigned long slide = 0);
+    void removeAggregation(String name);
+
+    // Non-blocking variants: never wait on the socket, report why a message was not sent
+    PublishResult tryPublishChannelUpdate(String name, bool channelValue);
+    PublishResult tryPublishChannelUpdate(String name, int channelValue);
+    PublishResult tryPublishChannelUpdate(String name, float channelValue);
+    PublishResult tryPublishChannelUpdate(String name, String channelValue);
+    PublishResult tryPublishChannelUpdates(ChannelUpdate updates[], size_t count);
+    void setPublishRateLimit(float messagesPerSecond, size_t bytesPerSecond);
+    size_t getTxBufferFree();
+    PublishResult getLastPublishResult();
+
     String getDeviceTopic();
     String getUpdateTopic();
 
@@ -48,7 +123,7 @@ private:
     static FastIoT *instance;
 
     WiFiClient wifiClient;
-    PubSubClient mqttClient;
+    MqttTransport mqttClient;
 
     String brokerUrl;
     int brokerPort;
@@ -69,8 +144,171 @@ private:
 
     ChannelCallback *channelCallbacks;
 
+    // Receives payload bytes from the MQTT client while a PUBLISH is being read
+    class PayloadStream : public Stream
+    {
+    public:
+        FastIoT *owner;
+
+        using Print::write;
+        size_t write(uint8_t b);
+        int available();
+        int read();
+        int peek();
+    };
+
+    PayloadStream payloadStream;
+    void (*payloadSink)(const uint8_t *chunk, size_t length, size_t offset, bool last);
+    uint8_t *streamWindow;
+    size_t streamWindowSize;
+    size_t streamFill;
+    size_t streamOffset;
+    bool streamOverflowed;
+    bool receivingStream;  // inside PayloadStream::write, publishing is refused
+
+    // Splits a streamed channel array into elements without holding the whole message
+    uint8_t decodeDepth;
+    bool decodeInString;
+    bool decodeEscape;
+    bool decodeSkipping;
+    bool decodeFailed;
+
+    // Credit buckets for publish rate limiting (0 rate = unlimited)
+    float messageRate;
+    float messageCredits;
+    size_t byteRate;
+    float byteCredits;
+    unsigned long lastCreditRefill;
+    PublishResult lastPublishResult;
+
+    struct TrackPoint
+    {
+        int32_t latitude;  // 1e-6 degrees
+        int32_t longitude;
+        unsigned long time;
+    };
+
+    TrackPoint *trackPoints;
+    size_t trackCapacity;
+    size_t trackCount;
+    unsigned long trackInterval;
+    unsigned long lastTrackUpload;
+    float trackMinDistance;
+    float trackMinHeading;
+    // Last kept fix and the straight segment it extends, kept across uploads
+    TrackPoint trackAnchor;
+    TrackPoint trackSegmentStart;
+    float trackSegmentBearing;
+    bool trackHasAnchor;
+    bool trackHasSegment;
+
+    String buildChannelPayload(ChannelUpdate updates[], size_t count);
+    PublishResult publishPayload(const String &payload, bool blocking);
+    void refillPublishCredits();
+    void bufferLocation(float latitude, float longitude);
+
+    struct RuleValue
+    {
+        uint8_t type;
+        union
+        {
+            bool boolean;
+            int32_t integer;
+            float number;
+            uint8_t text;  // index into edgeRuleStrings
+        };
+    };
+
+    // Compiled rule: "when <source> <op> <threshold> becomes true, set <target>"
+    struct EdgeRule
+    {
+        uint8_t source;  // index into edgeRuleStrings
+        uint8_t target;
+        uint8_t op;
+        bool active;     // last condition result, rules fire on transitions
+        bool reportPending;  // target state not yet published, retried by loop()
+        float threshold;
+        RuleValue then;
+        RuleValue otherwise;
+    };
+
+    EdgeRule *edgeRules;
+    size_t edgeRuleCount;
+    String *edgeRuleStrings;  // interned channel names and string values
+    size_t edgeRuleStringCount;
+    bool evaluatingRules;
+
+    // Samples folded into one point of the percentile sketch (t-digest)
+    struct Centroid
+    {
+        float mean;
+        uint32_t weight;
+    };
+
+    struct WindowPane
+    {
+        uint32_t count;
+        float minValue;
+        float maxValue;
+        float mean;
+        float m2;  // sum of squared deviations from the mean
+        uint8_t centroidCount;
+        Centroid centroids[FASTIOT_AGGREGATE_CENTROIDS];  // sorted by mean
+    };
+
+    struct WindowSummary
+    {
+        unsigned long closedAt;
+        uint32_t count;
+        float minValue;
+        float maxValue;
+        float mean;
+        float stddev;
+        float quantiles[3];
+    };
+
+    // A window is split into panes of one slide each; a tumbling window has a single pane
+    struct ChannelAggregate
+    {
+        String name;
+        unsigned long paneLength;
+        unsigned long paneStart;
+        uint8_t paneCount;
+        uint8_t currentPane;
+        WindowPane *panes;
+        WindowSummary backlog[FASTIOT_AGGREGATE_BACKLOG];  // closed windows not yet published, oldest first
+        uint8_t backlogCount;
+        ChannelAggregate *next;
+    };
+
+    ChannelAggregate *channelAggregates;
+    Centroid *aggregateScratch;  // merged centroids of the window being closed
+
+    bool sendChannelUpdates(ChannelUpdate updates[], size_t count);
+    ChannelAggregate *findAggregate(String name);
+    void recordAggregatedUpdates(ChannelUpdate updates[], size_t count);
+    ChannelUpdate *filterAggregatedUpdates(ChannelUpdate updates[], size_t &count);
+    void publishAggregates();
+    void closeWindow(ChannelAggregate *aggregate, unsigned long now);
+    static void resetPane(WindowPane &pane);
+    static void recordSample(WindowPane &pane, float value);
+    static void mergeCentroids(WindowPane &pane);
+    static float centroidQuantile(const Centroid *centroids, size_t count, uint32_t total, float minValue, float maxValue, float fraction);
+
+    bool compileRules(JsonArray rules);
+    bool compileRuleValue(JsonVariant value, RuleValue &out, String *strings, size_t &stringCount);
+    void evaluateRules(String name, JsonVariant value, uint8_t report);
+    bool applyRuleValue(uint8_t target, const RuleValue &value, uint8_t report);
+    static bool setRuleValue(JsonDocument &doc, const RuleValue &value, const String *strings);
+    void reportPendingRules();
+
     static void internalCallback(char *topic, byte *payload, unsigned int length);
     void processChannelMessage(String message);
+    void dispatchChannelUpdate(String name, JsonVariant value);
+    void receivePayloadByte(uint8_t b);
+    void decodePayloadByte(uint8_t b);
+    void finishStreamedPayload(String topic);
+    void resetPayloadStream();
 };
 
 #endif
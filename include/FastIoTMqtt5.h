@@ -0,0 +1,122 @@
+#ifndef FASTIOT_MQTT5_H
+#define FASTIOT_MQTT5_H
+
+#if defined(FASTIOT_MQTT5)
+
+#include <Arduino.h>
+#include <Client.h>
+
+// Buffer used for outgoing packets and for the header and payload of incoming ones
+#ifndef FASTIOT_MQTT5_BUFFER_SIZE
+#define FASTIOT_MQTT5_BUFFER_SIZE 256
+#endif
+
+// Topic aliases kept per direction (FastIoT publishes to a single topic)
+#ifndef FASTIOT_MQTT5_TOPIC_ALIASES
+#define FASTIOT_MQTT5_TOPIC_ALIASES 2
+#endif
+
+// Upper bound for the receive maximum, i.e. unacknowledged QoS 1 messages from the broker
+#ifndef FASTIOT_MQTT5_MAX_PENDING_ACKS
+#define FASTIOT_MQTT5_MAX_PENDING_ACKS 8
+#endif
+
+#ifndef FASTIOT_MQTT5_KEEPALIVE
+#define FASTIOT_MQTT5_KEEPALIVE 15
+#endif
+
+#ifndef FASTIOT_MQTT5_SOCKET_TIMEOUT
+#define FASTIOT_MQTT5_SOCKET_TIMEOUT 15
+#endif
+
+// Same meaning as in PubSubClient: fixed header plus the longest remaining length
+#ifndef MQTT_MAX_HEADER_SIZE
+#define MQTT_MAX_HEADER_SIZE 5
+#endif
+
+// Property bytes a PUBLISH may carry on top of an MQTT 3.1.1 one: property length and topic alias
+#define FASTIOT_MQTT5_PUBLISH_PROPERTIES_SIZE 4
+
+// Minimal MQTT 5 client exposing the subset of the PubSubClient API used by FastIoT.
+// QoS 0 publishes with topic aliases, QoS 0/1 subscriptions, session expiry and
+// receive maximum / maximum packet size negotiation.
+class FastIoTMqtt5
+{
+public:
+    enum State
+    {
+        CONNECTION_TIMEOUT = -4,
+        CONNECTION_LOST = -3,
+        CONNECT_FAILED = -2,
+        DISCONNECTED = -1,
+        CONNECTED = 0
+        // Positive values are the CONNACK or DISCONNECT reason code sent by the broker
+    };
+
+    FastIoTMqtt5(Client &client);
+    ~FastIoTMqtt5();
+
+    FastIoTMqtt5 &setServer(const char *host, uint16_t port);
+    FastIoTMqtt5 &setCallback(void (*callback)(char *topic, uint8_t *payload, unsigned int length));
+    FastIoTMqtt5 &setStream(Stream &stream);
+    uint16_t getBufferSize();
+    void setSessionExpiry(uint32_t seconds);
+    void setReceiveMaximum(uint16_t count);
+
+    bool connect(const char *id, const char *user, const char *pass);
+    bool connected();
+    bool sessionPresent();
+    int state();
+    void disconnect();
+
+    bool subscribe(const char *topic, uint8_t qos = 0);
+    bool publish(const char *topic, const char *payload);
+    bool publish(const char *topic, const uint8_t *payload, unsigned int length);
+    bool beginPublish(const char *topic, unsigned int length, bool retained);
+    size_t write(const uint8_t *data, size_t size);
+    int endPublish();
+    bool loop();
+
+private:
+    Client *client;
+    Stream *stream;
+    void (*callback)(char *topic, uint8_t *payload, unsigned int length);
+    const char *host;
+    uint16_t port;
+    uint8_t buffer[FASTIOT_MQTT5_BUFFER_SIZE];
+
+    int connectionState;
+    bool session;
+    uint32_t sessionExpiry;
+    uint16_t receiveMaximum;
+    uint16_t keepAlive;
+    uint16_t nextPacketId;
+    bool pingOutstanding;
+    unsigned long lastInActivity;
+    unsigned long lastOutActivity;
+
+    // Limits announced by the broker in CONNACK
+    uint32_t serverMaximumPacketSize;  // 0 = no limit
+    uint16_t serverTopicAliasMaximum;
+
+    String outboundAliases[FASTIOT_MQTT5_TOPIC_ALIASES];
+    String inboundAliases[FASTIOT_MQTT5_TOPIC_ALIASES];
+
+    uint16_t pendingAcks[FASTIOT_MQTT5_MAX_PENDING_ACKS];
+    uint8_t pendingAckCount;
+
+    size_t writePublishHeader(const char *topic, uint32_t payloadLength, bool retained, uint32_t &packetLength, uint16_t &newAlias);
+    bool readByte(uint8_t &value);
+    bool readVarInt(uint32_t &value);
+    bool skipBytes(uint32_t count);
+    bool readPacketBody(uint32_t length);
+    bool handlePacket();
+    bool handlePublish(uint8_t header, uint32_t remaining);
+    void queueAck(uint16_t packetId);
+    void parseConnack(uint32_t length);
+    void flushAcks();
+};
+
+#endif
+
+#endif
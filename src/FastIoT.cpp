@@ -0,0 +1,1562 @@
+#include "FastIoT.h"
+
+// Metres per 1e-6 degree of latitude (mean Earth radius)
+static const float METERS_PER_MICRODEGREE = 0.111195f;
+
+static float trackDistance(int32_t lat1, int32_t lng1, int32_t lat2, int32_t lng2) {
+    float dLat = (lat2 - lat1) * METERS_PER_MICRODEGREE;
+    float dLng = (lng2 - lng1) * METERS_PER_MICRODEGREE * cosf(lat1 * 1e-6f * DEG_TO_RAD);
+    return sqrtf(dLat * dLat + dLng * dLng);
+}
+
+enum {
+    RULE_OP_GT,
+    RULE_OP_GE,
+    RULE_OP_LT,
+    RULE_OP_LE,
+    RULE_OP_EQ,
+    RULE_OP_NE
+};
+
+// How a fired rule reports its target's new state
+enum {
+    RULE_REPORT_BLOCKING,      // local publishChannelUpdate()
+    RULE_REPORT_NON_BLOCKING,  // tryPublishChannelUpdate(), never waits on the socket
+    RULE_REPORT_DEFERRED       // inbound update, the MQTT client may be mid-packet: loop() reports
+};
+
+enum {
+    RULE_VALUE_NONE,
+    RULE_VALUE_BOOL,
+    RULE_VALUE_INT,
+    RULE_VALUE_FLOAT,
+    RULE_VALUE_STRING
+};
+
+static const float AGGREGATE_QUANTILES[3] = { 0.5f, 0.9f, 0.99f };
+static const char *AGGREGATE_QUANTILE_KEYS[3] = { "p50", "p90", "p99" };
+
+// Document capacity for a full rule set: {"rules": [...]} with up to six members
+// per rule, plus the copied strings, which never exceed the text itself
+static size_t ruleDocumentSize(size_t length) {
+    return JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(FASTIOT_MAX_RULES) + FASTIOT_MAX_RULES * JSON_OBJECT_SIZE(6) + length;
+}
+
+static int internRuleString(String *strings, size_t &stringCount, String value) {
+    for (size_t i = 0; i < stringCount; i++) {
+        if (strings[i] == value) {
+            return i;
+        }
+    }
+    strings[stringCount] = value;
+    return stringCount++;
+}
+
+static float trackBearing(int32_t lat1, int32_t lng1, int32_t lat2, int32_t lng2) {
+    float dLat = (float)(lat2 - lat1);
+    float dLng = (lng2 - lng1) * cosf(lat1 * 1e-6f * DEG_TO_RAD);
+    float bearing = atan2f(dLng, dLat) * RAD_TO_DEG;
+    return bearing < 0 ? bearing + 360 : bearing;
+}
+
+// Static instance for callback
+FastIoT* FastIoT::instance = nullptr;
+
+FastIoT::FastIoT() : mqttClient(wifiClient) {
+    instance = this;
+    messageCallback = nullptr;
+    channelCallbacks = nullptr;
+    brokerPort = 1883;
+    messageRate = 0;
+    messageCredits = 0;
+    byteRate = 0;
+    byteCredits = 0;
+    lastCreditRefill = 0;
+    lastPublishResult = PUBLISH_OK;
+    payloadStream.owner = this;
+    payloadSink = nullptr;
+    streamWindow = nullptr;
+    streamWindowSize = 0;
+    streamOverflowed = false;
+    receivingStream = false;
+    resetPayloadStream();
+    trackPoints = nullptr;
+    trackCapacity = 0;
+    trackCount = 0;
+    trackInterval = 0;
+    lastTrackUpload = 0;
+    trackMinDistance = 0;
+    trackMinHeading = 0;
+    trackSegmentBearing = 0;
+    trackHasAnchor = false;
+    trackHasSegment = false;
+    edgeRules = nullptr;
+    edgeRuleCount = 0;
+    edgeRuleStrings = nullptr;
+    edgeRuleStringCount = 0;
+    evaluatingRules = false;
+    channelAggregates = nullptr;
+    aggregateScratch = nullptr;
+}
+
+FastIoT::~FastIoT() {
+    // Clean up channel callbacks
+    ChannelCallback* current = channelCallbacks;
+    while (current != nullptr) {
+        ChannelCallback* next = current->next;
+        delete current;
+        current = next;
+    }
+
+    delete[] streamWindow;
+    delete[] trackPoints;
+    delete[] edgeRules;
+    delete[] edgeRuleStrings;
+
+    ChannelAggregate* aggregate = channelAggregates;
+    while (aggregate != nullptr) {
+        ChannelAggregate* next = aggregate->next;
+        delete[] aggregate->panes;
+        delete aggregate;
+        aggregate = next;
+    }
+    delete[] aggregateScratch;
+}
+
+void FastIoT::begin(String url, int port, String token, String devId) {
+    brokerUrl = url;
+    brokerPort = port;
+    deviceId = devId;
+    
+    // Parse token (username-password format)
+    int dashIndex = token.indexOf('-');
+    if (dashIndex > 0) {
+        username = token.substring(0, dashIndex);
+        password = token.substring(dashIndex + 1);
+    } else {
+        username = token;
+        password = "";
+    }
+    
+    // Set up topics
+    topic = "device/" + deviceId;
+    updateTopic = "device/" + deviceId + "/update";
+    
+    // Configure MQTT client
+    mqttClient.setServer(brokerUrl.c_str(), brokerPort);
+    mqttClient.setCallback(internalCallback);
+    
+    Serial.println("FastIoT Client initialized");
+    Serial.println("Device ID: " + deviceId);
+    Serial.println("Subscribe Topic: " + topic);
+    Serial.println("Publish Topic: " + updateTopic);
+}
+
+bool FastIoT::connectWiFi(String ssid, String wifiPassword) {
+    WiFi.begin(ssid.c_str(), wifiPassword.c_str());
+    
+    Serial.print("Connecting to WiFi");
+    int attempts = 0;
+    while (WiFi.status() != WL_CONNECTED && attempts < 20) {
+        delay(500);
+        Serial.print(".");
+        attempts++;
+    }
+    
+    if (WiFi.status() == WL_CONNECTED) {
+        Serial.println();
+        Serial.println("WiFi connected!");
+        Serial.print("IP address: ");
+        Serial.println(WiFi.localIP());
+        return true;
+    } else {
+        Serial.println();
+        Serial.println("WiFi connection failed!");
+        return false;
+    }
+}
+
+bool FastIoT::connectMQTT() {
+    if (!WiFi.isConnected()) {
+        Serial.println("WiFi not connected. Cannot connect to MQTT.");
+        return false;
+    }
+    
+    Serial.print("Connecting to MQTT broker...");
+    
+#if defined(FASTIOT_MQTT5)
+    // A stable client id lets the broker resume the session after a reconnect
+    String clientId = "ESP8266Client-" + deviceId;
+#else
+    String clientId = "ESP8266Client-" + deviceId + "-" + String(random(0xffff), HEX);
+#endif
+    
+    if (mqttClient.connect(clientId.c_str(), username.c_str(), password.c_str())) {
+        Serial.println(" connected!");
+#if defined(FASTIOT_MQTT5)
+        if (mqttClient.sessionPresent()) {
+            Serial.println("Resumed MQTT session, still subscribed to topic: " + topic);
+            return true;
+        }
+#endif
+        Serial.println("Connected to MQTT broker. Subscribed to topic: " + topic);
+        return subscribe();
+    } else {
+        Serial.print(" failed, rc=");
+        Serial.print(mqttClient.state());
+        Serial.println(" retrying in 5 seconds");
+        return false;
+    }
+}
+
+void FastIoT::setCallback(void (*callback)(String topic, String message)) {
+    messageCallback = callback;
+}
+
+void FastIoT::onChannelChange(String name, void (*callback)(String name, JsonVariant value)) {
+    // Check if callback already exists for this channel
+    ChannelCallback* current = channelCallbacks;
+    while (current != nullptr) {
+        if (current->name == name) {
+            // Update existing callback
+            current->callback = callback;
+            Serial.println("Updated callback for channel: " + name);
+            return;
+        }
+        current = current->next;
+    }
+    
+    // Create new callback entry
+    ChannelCallback* newCallback = new ChannelCallback();
+    newCallback->name = name;
+    newCallback->callback = callback;
+    newCallback->next = channelCallbacks;
+    channelCallbacks = newCallback;
+    
+    Serial.println("Added callback for channel: " + name);
+}
+
+void FastIoT::removeChannelCallback(String name) {
+    ChannelCallback* current = channelCallbacks;
+    ChannelCallback* previous = nullptr;
+    
+    while (current != nullptr) {
+        if (current->name == name) {
+            if (previous == nullptr) {
+                // Removing first element
+                channelCallbacks = current->next;
+            } else {
+                previous->next = current->next;
+            }
+            delete current;
+            Serial.println("Removed callback for channel: " + name);
+            return;
+        }
+        previous = current;
+        current = current->next;
+    }
+    
+    Serial.println("Callback not found for channel: " + name);
+}
+
+void FastIoT::enableStreamingReceive(size_t windowSize) {
+    // The window must hold every payload PubSubClient can still deliver whole,
+    // so that only oversized messages take the streaming path
+    size_t minimum = mqttClient.getBufferSize();
+    if (windowSize < minimum) {
+        windowSize = minimum;
+    }
+
+    delete[] streamWindow;
+    streamWindow = new uint8_t[windowSize];
+    streamWindowSize = windowSize;
+    resetPayloadStream();
+
+    mqttClient.setStream(payloadStream);
+    Serial.println("Streaming receive enabled, window: " + String(windowSize) + " bytes");
+}
+
+void FastIoT::setPayloadSink(void (*sink)(const uint8_t *chunk, size_t length, size_t offset, bool last)) {
+    payloadSink = sink;
+}
+
+bool FastIoT::aggregateChannel(String name, unsigned long windowLength, unsigned long slide) {
+    uint8_t paneCount = 1;
+    unsigned long paneLength = windowLength;
+
+    if (slide > 0 && slide < windowLength) {
+        if (windowLength % slide != 0 || windowLength / slide > FASTIOT_MAX_WINDOW_PANES) {
+            Serial.println("Window length must be a multiple of the slide, at most " + String(FASTIOT_MAX_WINDOW_PANES) + " slides long");
+            return false;
+        }
+        paneCount = windowLength / slide;
+        paneLength = slide;
+    }
+    if (paneLength == 0) {
+        return false;
+    }
+
+    // Room to merge the largest possible window, allocated once for all channels
+    if (aggregateScratch == nullptr) {
+        aggregateScratch = new Centroid[FASTIOT_MAX_WINDOW_PANES * FASTIOT_AGGREGATE_CENTROIDS];
+    }
+
+    ChannelAggregate* aggregate = findAggregate(name);
+    if (aggregate != nullptr) {
+        delete[] aggregate->panes;
+    } else {
+        aggregate = new ChannelAggregate();
+        aggregate->name = name;
+        aggregate->next = channelAggregates;
+        channelAggregates = aggregate;
+    }
+
+    aggregate->paneLength = paneLength;
+    aggregate->paneStart = millis();
+    aggregate->paneCount = paneCount;
+    aggregate->currentPane = 0;
+    aggregate->backlogCount = 0;
+    aggregate->panes = new WindowPane[paneCount];
+    for (uint8_t i = 0; i < paneCount; i++) {
+        resetPane(aggregate->panes[i]);
+    }
+
+    Serial.println("Aggregating channel: " + name);
+    return true;
+}
+
+void FastIoT::removeAggregation(String name) {
+    ChannelAggregate* current = channelAggregates;
+    ChannelAggregate* previous = nullptr;
+
+    while (current != nullptr) {
+        if (current->name == name) {
+            if (previous == nullptr) {
+                channelAggregates = current->next;
+            } else {
+                previous->next = current->next;
+            }
+            delete[] current->panes;
+            delete current;
+            Serial.println("Removed aggregation for channel: " + name);
+            return;
+        }
+        previous = current;
+        current = current->next;
+    }
+
+    Serial.println("Aggregation not found for channel: " + name);
+}
+
+FastIoT::ChannelAggregate* FastIoT::findAggregate(String name) {
+    ChannelAggregate* current = channelAggregates;
+    while (current != nullptr) {
+        if (current->name == name) {
+            return current;
+        }
+        current = current->next;
+    }
+    return nullptr;
+}
+
+void FastIoT::recordAggregatedUpdates(ChannelUpdate updates[], size_t count) {
+    if (channelAggregates == nullptr) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!updates[i].value.is<float>()) {
+            continue;
+        }
+        ChannelAggregate* aggregate = findAggregate(updates[i].name);
+        if (aggregate != nullptr) {
+            recordSample(aggregate->panes[aggregate->currentPane], updates[i].value.as<float>());
+        }
+    }
+}
+
+// Returns the updates that still have to be published. When some were aggregated this is
+// a new array the caller deletes, otherwise updates itself.
+ChannelUpdate* FastIoT::filterAggregatedUpdates(ChannelUpdate updates[], size_t &count) {
+    if (channelAggregates == nullptr) {
+        return updates;
+    }
+
+    ChannelUpdate* pending = nullptr;
+    size_t pendingCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        bool aggregated = updates[i].value.is<float>() && findAggregate(updates[i].name) != nullptr;
+        if (aggregated && pending == nullptr) {
+            pending = new ChannelUpdate[count];
+            for (size_t j = 0; j < i; j++) {
+                pending[pendingCount++] = updates[j];
+            }
+        } else if (!aggregated && pending != nullptr) {
+            pending[pendingCount++] = updates[i];
+        }
+    }
+
+    if (pending == nullptr) {
+        return updates;
+    }
+    count = pendingCount;
+    return pending;
+}
+
+void FastIoT::publishAggregates() {
+    unsigned long now = millis();
+    size_t closing = 0;
+    size_t pending = 0;
+    for (ChannelAggregate* aggregate = channelAggregates; aggregate != nullptr; aggregate = aggregate->next) {
+        if (now - aggregate->paneStart >= aggregate->paneLength) {
+            closeWindow(aggregate, now);
+            closing++;
+        }
+        pending += aggregate->backlogCount;
+    }
+
+    // Summaries left over from a failed send go out with the next closing window
+    if (closing == 0 || pending == 0) {
+        return;
+    }
+
+    DynamicJsonDocument doc(JSON_ARRAY_SIZE(pending) + pending * JSON_OBJECT_SIZE(9));
+    JsonArray values = doc.to<JsonArray>();
+    ChannelUpdate* summaries = new ChannelUpdate[pending];
+    size_t count = 0;
+
+    for (ChannelAggregate* aggregate = channelAggregates; aggregate != nullptr; aggregate = aggregate->next) {
+        for (uint8_t i = 0; i < aggregate->backlogCount; i++) {
+            WindowSummary &closed = aggregate->backlog[i];
+            JsonObject summary = values.createNestedObject();
+            summary["count"] = closed.count;
+            summary["min"] = closed.minValue;
+            summary["max"] = closed.maxValue;
+            summary["mean"] = closed.mean;
+            summary["stddev"] = closed.stddev;
+            for (int q = 0; q < 3; q++) {
+                summary[AGGREGATE_QUANTILE_KEYS[q]] = closed.quantiles[q];
+            }
+            summary["age"] = now - closed.closedAt;
+
+            summaries[count].name = aggregate->name;
+            summaries[count].value = summary;
+            count++;
+        }
+    }
+
+    if (sendChannelUpdates(summaries, count)) {
+        for (ChannelAggregate* aggregate = channelAggregates; aggregate != nullptr; aggregate = aggregate->next) {
+            aggregate->backlogCount = 0;
+        }
+    } else {
+        Serial.println("Keeping " + String((int)count) + " window summaries until they can be published");
+    }
+    delete[] summaries;
+}
+
+void FastIoT::closeWindow(ChannelAggregate *aggregate, unsigned long now) {
+    Centroid* centroids = aggregateScratch;
+
+    // Merge the panes of the window: moments exactly (Chan et al.), centroids into one sorted list
+    uint32_t total = 0;
+    float minValue = 0;
+    float maxValue = 0;
+    float mean = 0;
+    float m2 = 0;
+    size_t centroidCount = 0;
+    for (uint8_t i = 0; i < aggregate->paneCount; i++) {
+        WindowPane &pane = aggregate->panes[i];
+        if (pane.count == 0) {
+            continue;
+        }
+        if (total == 0 || pane.minValue < minValue) {
+            minValue = pane.minValue;
+        }
+        if (total == 0 || pane.maxValue > maxValue) {
+            maxValue = pane.maxValue;
+        }
+        uint32_t merged = total + pane.count;
+        float delta = pane.mean - mean;
+        mean += delta * pane.count / merged;
+        m2 += pane.m2 + delta * delta * ((float)total * pane.count / merged);
+        total = merged;
+
+        for (uint8_t c = 0; c < pane.centroidCount; c++) {
+            size_t j = centroidCount++;
+            while (j > 0 && centroids[j - 1].mean > pane.centroids[c].mean) {
+                centroids[j] = centroids[j - 1];
+                j--;
+            }
+            centroids[j] = pane.centroids[c];
+        }
+    }
+
+    // Slide on: the oldest pane starts collecting the next slide
+    aggregate->currentPane = (aggregate->currentPane + 1) % aggregate->paneCount;
+    resetPane(aggregate->panes[aggregate->currentPane]);
+    if (now - aggregate->paneStart >= 2 * aggregate->paneLength) {
+        aggregate->paneStart = now;
+    } else {
+        aggregate->paneStart += aggregate->paneLength;
+    }
+
+    // Windows without samples publish nothing
+    if (total > 0) {
+        if (aggregate->backlogCount == FASTIOT_AGGREGATE_BACKLOG) {
+            // Unsent for too long: keep the most recent windows
+            memmove(aggregate->backlog, aggregate->backlog + 1, (FASTIOT_AGGREGATE_BACKLOG - 1) * sizeof(WindowSummary));
+            aggregate->backlogCount--;
+        }
+
+        WindowSummary &closed = aggregate->backlog[aggregate->backlogCount++];
+        closed.closedAt = now;
+        closed.count = total;
+        closed.minValue = minValue;
+        closed.maxValue = maxValue;
+        closed.mean = mean;
+        closed.stddev = total > 1 ? sqrtf(m2 / (total - 1)) : 0;
+        for (int q = 0; q < 3; q++) {
+            closed.quantiles[q] = centroidQuantile(centroids, centroidCount, total, minValue, maxValue, AGGREGATE_QUANTILES[q]);
+        }
+    }
+}
+
+void FastIoT::resetPane(WindowPane &pane) {
+    pane.count = 0;
+    pane.minValue = 0;
+    pane.maxValue = 0;
+    pane.mean = 0;
+    pane.m2 = 0;
+    pane.centroidCount = 0;
+}
+
+// Welford update of the moments, and the sample added to the pane's t-digest.
+// A full digest first merges its cheapest neighbouring pair, so memory stays fixed.
+void FastIoT::recordSample(WindowPane &pane, float value) {
+    pane.count++;
+    if (pane.count == 1) {
+        pane.minValue = value;
+        pane.maxValue = value;
+    } else if (value < pane.minValue) {
+        pane.minValue = value;
+    } else if (value > pane.maxValue) {
+        pane.maxValue = value;
+    }
+    float delta = value - pane.mean;
+    pane.mean += delta / pane.count;
+    pane.m2 += delta * (value - pane.mean);
+
+    if (pane.centroidCount == FASTIOT_AGGREGATE_CENTROIDS) {
+        mergeCentroids(pane);
+    }
+    uint8_t i = pane.centroidCount++;
+    while (i > 0 && pane.centroids[i - 1].mean > value) {
+        pane.centroids[i] = pane.centroids[i - 1];
+        i--;
+    }
+    pane.centroids[i].mean = value;
+    pane.centroids[i].weight = 1;
+}
+
+// Merges the neighbouring pair whose combined weight is smallest relative to
+// q(1 - q) at its position, so centroids near the tails stay small and p99 sharp
+void FastIoT::mergeCentroids(WindowPane &pane) {
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < pane.centroidCount; i++) {
+        total += pane.centroids[i].weight;
+    }
+
+    uint8_t best = 0;
+    float bestCost = 0;
+    uint32_t before = 0;
+    for (uint8_t i = 0; i + 1 < pane.centroidCount; i++) {
+        uint32_t weight = pane.centroids[i].weight + pane.centroids[i + 1].weight;
+        float q = (before + weight / 2.0f) / total;
+        float cost = weight / (q * (1 - q) + 1.0f / total);
+        if (i == 0 || cost < bestCost) {
+            best = i;
+            bestCost = cost;
+        }
+        before += pane.centroids[i].weight;
+    }
+
+    Centroid &left = pane.centroids[best];
+    const Centroid &right = pane.centroids[best + 1];
+    uint32_t weight = left.weight + right.weight;
+    left.mean += (right.mean - left.mean) * right.weight / weight;
+    left.weight = weight;
+    for (uint8_t i = best + 1; i + 1 < pane.centroidCount; i++) {
+        pane.centroids[i] = pane.centroids[i + 1];
+    }
+    pane.centroidCount--;
+}
+
+// Each centroid's weight is centred on its mean; ranks between centres are
+// interpolated, and the tails run out to the exact minimum and maximum
+float FastIoT::centroidQuantile(const Centroid *centroids, size_t count, uint32_t total, float minValue, float maxValue, float fraction) {
+    float target = fraction * total;
+    float previousMean = minValue;
+    float previousRank = 0;
+    float rank = 0;
+    for (size_t i = 0; i < count; i++) {
+        float centre = rank + centroids[i].weight / 2.0f;
+        if (target < centre) {
+            return previousMean + (centroids[i].mean - previousMean) * (target - previousRank) / (centre - previousRank);
+        }
+        previousMean = centroids[i].mean;
+        previousRank = centre;
+        rank += centroids[i].weight;
+    }
+    if (total <= previousRank) {
+        return maxValue;
+    }
+    return previousMean + (maxValue - previousMean) * (target - previousRank) / (total - previousRank);
+}
+
+bool FastIoT::setRules(String rules) {
+    DynamicJsonDocument doc(ruleDocumentSize(rules.length()));
+    DeserializationError error = deserializeJson(doc, rules);
+
+    if (error) {
+        Serial.println("Failed to parse rules JSON: " + String(error.c_str()));
+        return false;
+    }
+
+    if (doc.is<JsonObject>() && doc.containsKey("rules")) {
+        return compileRules(doc["rules"]);
+    }
+    return compileRules(doc.as<JsonArray>());
+}
+
+void FastIoT::clearRules() {
+    delete[] edgeRules;
+    delete[] edgeRuleStrings;
+    edgeRules = nullptr;
+    edgeRuleStrings = nullptr;
+    edgeRuleCount = 0;
+    edgeRuleStringCount = 0;
+}
+
+size_t FastIoT::getRuleCount() {
+    return edgeRuleCount;
+}
+
+bool FastIoT::compileRules(JsonArray rules) {
+    if (rules.isNull() || rules.size() > FASTIOT_MAX_RULES) {
+        Serial.println("Invalid rule set, keeping current rules");
+        return false;
+    }
+
+    // Each rule interns at most four strings: source, target and two string values
+    size_t count = rules.size();
+    EdgeRule *compiled = new EdgeRule[count];
+    String *strings = new String[count * 4];
+    size_t stringCount = 0;
+    size_t index = 0;
+
+    for (JsonObject rule : rules) {
+        String source = rule["if"] | "";
+        String target = rule["then"] | "";
+        String op = rule["op"] | "";
+        JsonVariant threshold = rule["value"];
+
+        EdgeRule &out = compiled[index];
+        if (op == ">") out.op = RULE_OP_GT;
+        else if (op == ">=") out.op = RULE_OP_GE;
+        else if (op == "<") out.op = RULE_OP_LT;
+        else if (op == "<=") out.op = RULE_OP_LE;
+        else if (op == "==") out.op = RULE_OP_EQ;
+        else if (op == "!=") out.op = RULE_OP_NE;
+        else op = "";
+
+        bool valid = source.length() > 0 && target.length() > 0 && op.length() > 0 &&
+                     (threshold.is<float>() || threshold.is<bool>()) &&
+                     compileRuleValue(rule["set"], out.then, strings, stringCount) &&
+                     out.then.type != RULE_VALUE_NONE &&
+                     compileRuleValue(rule["else"], out.otherwise, strings, stringCount);
+        if (!valid) {
+            Serial.println("Invalid rule at index " + String((int)index) + ", keeping current rules");
+            delete[] compiled;
+            delete[] strings;
+            return false;
+        }
+
+        out.source = internRuleString(strings, stringCount, source);
+        out.target = internRuleString(strings, stringCount, target);
+        out.threshold = threshold.is<bool>() ? (threshold.as<bool>() ? 1 : 0) : threshold.as<float>();
+        out.active = false;
+        out.reportPending = false;
+        index++;
+    }
+
+    clearRules();
+    edgeRules = compiled;
+    edgeRuleCount = count;
+    edgeRuleStrings = strings;
+    edgeRuleStringCount = stringCount;
+
+    Serial.println("Compiled " + String((int)count) + " edge rules");
+    return true;
+}
+
+bool FastIoT::compileRuleValue(JsonVariant value, RuleValue &out, String *strings, size_t &stringCount) {
+    if (value.isNull()) {
+        out.type = RULE_VALUE_NONE;
+    } else if (value.is<bool>()) {
+        out.type = RULE_VALUE_BOOL;
+        out.boolean = value.as<bool>();
+    } else if (value.is<int>()) {
+        out.type = RULE_VALUE_INT;
+        out.integer = value.as<int>();
+    } else if (value.is<float>()) {
+        out.type = RULE_VALUE_FLOAT;
+        out.number = value.as<float>();
+    } else if (value.is<const char*>()) {
+        out.type = RULE_VALUE_STRING;
+        out.text = internRuleString(strings, stringCount, value.as<String>());
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void FastIoT::evaluateRules(String name, JsonVariant value, uint8_t report) {
+    // Actions do not trigger further rules, so a rule set cannot loop
+    if (edgeRuleCount == 0 || evaluatingRules) {
+        return;
+    }
+    if (!value.is<float>() && !value.is<bool>()) {
+        return;
+    }
+
+    int source = -1;
+    for (size_t i = 0; i < edgeRuleStringCount; i++) {
+        if (edgeRuleStrings[i] == name) {
+            source = i;
+            break;
+        }
+    }
+    if (source < 0) {
+        return;
+    }
+
+    float reading = value.is<bool>() ? (value.as<bool>() ? 1 : 0) : value.as<float>();
+
+    evaluatingRules = true;
+    for (size_t i = 0; i < edgeRuleCount; i++) {
+        EdgeRule &rule = edgeRules[i];
+        if (rule.source != source) {
+            continue;
+        }
+
+        bool condition;
+        switch (rule.op) {
+            case RULE_OP_GT: condition = reading > rule.threshold; break;
+            case RULE_OP_GE: condition = reading >= rule.threshold; break;
+            case RULE_OP_LT: condition = reading < rule.threshold; break;
+            case RULE_OP_LE: condition = reading <= rule.threshold; break;
+            case RULE_OP_EQ: condition = reading == rule.threshold; break;
+            default: condition = reading != rule.threshold; break;
+        }
+
+        if (condition != rule.active) {
+            rule.active = condition;
+            const RuleValue &action = condition ? rule.then : rule.otherwise;
+            if (action.type != RULE_VALUE_NONE) {
+                rule.reportPending = !applyRuleValue(rule.target, action, report);
+            }
+        }
+    }
+    evaluatingRules = false;
+}
+
+// Stores a rule action as doc["value"]; false for an empty action
+bool FastIoT::setRuleValue(JsonDocument &doc, const RuleValue &value, const String *strings) {
+    switch (value.type) {
+        case RULE_VALUE_BOOL: doc["value"] = value.boolean; return true;
+        case RULE_VALUE_INT: doc["value"] = value.integer; return true;
+        case RULE_VALUE_FLOAT: doc["value"] = value.number; return true;
+        case RULE_VALUE_STRING: doc["value"] = strings[value.text]; return true;
+        default: return false;
+    }
+}
+
+// Returns false when the broker has not been told about the new state yet
+bool FastIoT::applyRuleValue(uint8_t target, const RuleValue &value, uint8_t report) {
+    DynamicJsonDocument doc(64);
+    if (!setRuleValue(doc, value, edgeRuleStrings)) {
+        return true;
+    }
+
+    String name = edgeRuleStrings[target];
+    Serial.println("Edge rule fired: " + name);
+
+    // Drive the actuator locally, then report its new state
+    dispatchChannelUpdate(name, doc["value"]);
+    if (report == RULE_REPORT_DEFERRED || !mqttClient.connected()) {
+        return false;
+    }
+
+    ChannelUpdate updates[1] = {
+        { name, doc["value"] }
+    };
+    if (report == RULE_REPORT_BLOCKING) {
+        return publishChannelUpdates(updates, 1);
+    }
+
+    // Inside a non-blocking publish: never wait on the socket, loop() retries the report
+    return publishPayload(buildChannelPayload(updates, 1), false) == PUBLISH_OK;
+}
+
+void FastIoT::reportPendingRules() {
+    for (size_t i = 0; i < edgeRuleCount; i++) {
+        EdgeRule &rule = edgeRules[i];
+        if (!rule.reportPending) {
+            continue;
+        }
+
+        // Report the value the rule applied last; a rule without "else" keeps its "then" value
+        const RuleValue &value = (rule.active || rule.otherwise.type == RULE_VALUE_NONE) ? rule.then : rule.otherwise;
+        DynamicJsonDocument doc(64);
+        setRuleValue(doc, value, edgeRuleStrings);
+
+        ChannelUpdate updates[1] = {
+            { edgeRuleStrings[rule.target], doc["value"] }
+        };
+        if (sendChannelUpdates(updates, 1)) {
+            rule.reportPending = false;
+        }
+    }
+}
+
+bool FastIoT::subscribe() {
+    if (mqttClient.connected()) {
+#if defined(FASTIOT_MQTT5)
+        // QoS 1 so commands sent while offline arrive when the session resumes
+        bool result = mqttClient.subscribe(topic.c_str(), 1);
+#else
+        bool result = mqttClient.subscribe(topic.c_str());
+#endif
+        if (result) {
+            Serial.println("Successfully subscribed to: " + topic);
+        } else {
+            Serial.println("Failed to subscribe to: " + topic);
+        }
+        return result;
+    }
+    return false;
+}
+
+bool FastIoT::publishChannelUpdate(String name, bool channelValue) {
+    DynamicJsonDocument doc(64);
+    doc["value"] = channelValue;
+
+    ChannelUpdate updates[1] = {
+        { name, doc["value"] }
+    };
+
+    return publishChannelUpdates(updates, 1);
+}
+
+bool FastIoT::publishChannelUpdate(String name, int channelValue) {
+    DynamicJsonDocument doc(64);
+    doc["value"] = channelValue;
+
+    ChannelUpdate updates[1] = {
+        { name, doc["value"] }
+    };
+
+    return publishChannelUpdates(updates, 1);
+}
+
+bool FastIoT::publishChannelUpdate(String name, float channelValue) {
+    DynamicJsonDocument doc(64);
+    doc["value"] = channelValue;
+
+    ChannelUpdate updates[1] = {
+        { name, doc["value"] }
+    };
+
+    return publishChannelUpdates(updates, 1);
+}
+
+bool FastIoT::publishChannelUpdate(String name, String channelValue) {
+    DynamicJsonDocument doc(64);
+    doc["value"] = channelValue;
+
+    ChannelUpdate updates[1] = {
+        { name, doc["value"] }
+    };
+
+    return publishChannelUpdates(updates, 1);
+}
+
+bool FastIoT::publishChannelUpdates(ChannelUpdate updates[], size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        evaluateRules(updates[i].name, updates[i].value, RULE_REPORT_BLOCKING);
+    }
+
+    // Aggregated channels are summarised by loop() instead of published one by one
+    recordAggregatedUpdates(updates, count);
+    size_t pendingCount = count;
+    ChannelUpdate* pending = filterAggregatedUpdates(updates, pendingCount);
+
+    bool result = true;
+    if (pendingCount > 0) {
+        result = sendChannelUpdates(pending, pendingCount);
+    } else {
+        lastPublishResult = PUBLISH_OK;
+    }
+
+    if (pending != updates) {
+        delete[] pending;
+    }
+    return result;
+}
+
+bool FastIoT::sendChannelUpdates(ChannelUpdate updates[], size_t count) {
+    String payload = buildChannelPayload(updates, count);
+    PublishResult result = publishPayload(payload, true);
+
+    if (result == PUBLISH_OK) {
+        Serial.println("Published: " + payload);
+    } else if (result == PUBLISH_NOT_CONNECTED) {
+        Serial.println("MQTT not connected. Cannot publish.");
+    } else {
+        Serial.println("Failed to publish message");
+    }
+
+    return result == PUBLISH_OK;
+}
+
+bool FastIoT::updateLocation(float latitude, float longitude) {
+    if (trackCapacity > 0) {
+        bufferLocation(latitude, longitude);
+        return true;
+    }
+
+    DynamicJsonDocument doc(256);
+    doc["id"] = deviceId.toInt();
+    doc["latitude"] = String(latitude, 6);   // giữ 6 chữ số sau dấu chấm
+    doc["longitude"] = String(longitude, 6);
+
+    String payload;
+    serializeJson(doc, payload);
+
+    PublishResult result = publishPayload(payload, true);
+
+    if (result == PUBLISH_OK) {
+        Serial.println("Published location: " + payload);
+    } else if (result == PUBLISH_NOT_CONNECTED) {
+        Serial.println("MQTT not connected. Cannot publish.");
+    } else {
+        Serial.println("Failed to publish location");
+    }
+
+    return result == PUBLISH_OK;
+}
+
+void FastIoT::setLocationBuffering(size_t capacity, unsigned long uploadInterval, float minDistance, float minHeadingChange) {
+    if (trackCount > 0) {
+        flushLocationTrack();
+    }
+
+    delete[] trackPoints;
+    trackPoints = nullptr;
+    trackCapacity = 0;
+    trackCount = 0;
+
+    if (capacity > 0) {
+        // Two points are needed to carry a delta
+        trackCapacity = capacity < 2 ? 2 : capacity;
+        trackPoints = new TrackPoint[trackCapacity];
+    }
+    trackInterval = uploadInterval;
+    trackMinDistance = minDistance;
+    trackMinHeading = minHeadingChange;
+    trackHasAnchor = false;
+    trackHasSegment = false;
+    lastTrackUpload = millis();
+}
+
+bool FastIoT::flushLocationTrack() {
+    lastTrackUpload = millis();
+    if (trackCount == 0) {
+        return true;
+    }
+
+    DynamicJsonDocument doc(JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(6) + 3 * JSON_ARRAY_SIZE(trackCount) + 64);
+    doc["id"] = deviceId.toInt();
+
+    // Latest fix in the single-point format so the device position stays current
+    TrackPoint &latest = trackPoints[trackCount - 1];
+    doc["latitude"] = String(latest.latitude / 1e6, 6);
+    doc["longitude"] = String(latest.longitude / 1e6, 6);
+
+    // First fix in 1e-6 degrees, then per-point deltas; age and dt are in ms
+    JsonObject track = doc.createNestedObject("track");
+    track["age"] = lastTrackUpload - trackPoints[0].time;
+    track["lat"] = trackPoints[0].latitude;
+    track["lng"] = trackPoints[0].longitude;
+    JsonArray dt = track.createNestedArray("dt");
+    JsonArray dLat = track.createNestedArray("dlat");
+    JsonArray dLng = track.createNestedArray("dlng");
+    for (size_t i = 1; i < trackCount; i++) {
+        dt.add(trackPoints[i].time - trackPoints[i - 1].time);
+        dLat.add(trackPoints[i].latitude - trackPoints[i - 1].latitude);
+        dLng.add(trackPoints[i].longitude - trackPoints[i - 1].longitude);
+    }
+
+    String payload;
+    serializeJson(doc, payload);
+
+    PublishResult result = publishPayload(payload, true);
+
+    if (result == PUBLISH_OK) {
+        Serial.println("Published location track: " + String(trackCount) + " points, " + String(payload.length()) + " bytes");
+        trackCount = 0;
+    } else if (result == PUBLISH_NOT_CONNECTED) {
+        Serial.println("MQTT not connected. Keeping " + String(trackCount) + " buffered fixes.");
+    } else {
+        Serial.println("Failed to publish location track");
+    }
+
+    return result == PUBLISH_OK;
+}
+
+void FastIoT::bufferLocation(float latitude, float longitude) {
+    TrackPoint point;
+    point.latitude = lround(latitude * 1e6);
+    point.longitude = lround(longitude * 1e6);
+    point.time = millis();
+
+    if (trackHasAnchor) {
+        // Jitter around a stationary position
+        if (trackDistance(trackAnchor.latitude, trackAnchor.longitude, point.latitude, point.longitude) < trackMinDistance) {
+            return;
+        }
+
+        // Still on the current straight segment: move its buffered end point instead of adding one.
+        // Both the latest step and the whole segment must keep the initial bearing, so sharp
+        // corners are kept and slow curves cannot drift away either.
+        if (trackHasSegment && trackCount > 0) {
+            float stepTurn = fabsf(trackBearing(trackAnchor.latitude, trackAnchor.longitude, point.latitude, point.longitude) - trackSegmentBearing);
+            float segmentTurn = fabsf(trackBearing(trackSegmentStart.latitude, trackSegmentStart.longitude, point.latitude, point.longitude) - trackSegmentBearing);
+            if (stepTurn > 180) {
+                stepTurn = 360 - stepTurn;
+            }
+            if (segmentTurn > 180) {
+                segmentTurn = 360 - segmentTurn;
+            }
+            if (stepTurn < trackMinHeading && segmentTurn < trackMinHeading) {
+                trackPoints[trackCount - 1] = point;
+                trackAnchor = point;
+                return;
+            }
+        }
+
+        trackSegmentStart = trackAnchor;
+        trackSegmentBearing = trackBearing(trackAnchor.latitude, trackAnchor.longitude, point.latitude, point.longitude);
+        trackHasSegment = true;
+    }
+
+    if (trackCount == trackCapacity && !flushLocationTrack()) {
+        // Offline with a full buffer: keep the most recent part of the track
+        memmove(trackPoints, trackPoints + 1, (trackCapacity - 1) * sizeof(TrackPoint));
+        trackCount--;
+    }
+
+    trackPoints[trackCount++] = point;
+    trackAnchor = point;
+    trackHasAnchor = true;
+}
+
+PublishResult FastIoT::tryPublishChannelUpdate(String name, bool channelValue) {
+    DynamicJsonDocument doc(64);
+    doc["value"] = channelValue;
+
+    ChannelUpdate updates[1] = {
+        { name, doc["value"] }
+    };
+
+    return tryPublishChannelUpdates(updates, 1);
+}
+
+PublishResult FastIoT::tryPublishChannelUpdate(String name, int channelValue) {
+    DynamicJsonDocument doc(64);
+    doc["value"] = channelValue;
+
+    ChannelUpdate updates[1] = {
+        { name, doc["value"] }
+    };
+
+    return tryPublishChannelUpdates(updates, 1);
+}
+
+PublishResult FastIoT::tryPublishChannelUpdate(String name, float channelValue) {
+    DynamicJsonDocument doc(64);
+    doc["value"] = channelValue;
+
+    ChannelUpdate updates[1] = {
+        { name, doc["value"] }
+    };
+
+    return tryPublishChannelUpdates(updates, 1);
+}
+
+PublishResult FastIoT::tryPublishChannelUpdate(String name, String channelValue) {
+    DynamicJsonDocument doc(64);
+    doc["value"] = channelValue;
+
+    ChannelUpdate updates[1] = {
+        { name, doc["value"] }
+    };
+
+    return tryPublishChannelUpdates(updates, 1);
+}
+
+PublishResult FastIoT::tryPublishChannelUpdates(ChannelUpdate updates[], size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        evaluateRules(updates[i].name, updates[i].value, RULE_REPORT_NON_BLOCKING);
+    }
+
+    size_t pendingCount = count;
+    ChannelUpdate* pending = filterAggregatedUpdates(updates, pendingCount);
+
+    // No logging on the busy paths: callers may retry this every loop iteration
+    PublishResult result = PUBLISH_OK;
+    if (pendingCount > 0) {
+        result = publishPayload(buildChannelPayload(pending, pendingCount), false);
+    } else {
+        lastPublishResult = PUBLISH_OK;
+    }
+
+    // Samples are only taken once the caller will not retry the same updates
+    if (result != PUBLISH_WOULD_BLOCK && result != PUBLISH_RATE_LIMITED) {
+        recordAggregatedUpdates(updates, count);
+    }
+
+    if (pending != updates) {
+        delete[] pending;
+    }
+    return result;
+}
+
+void FastIoT::setPublishRateLimit(float messagesPerSecond, size_t bytesPerSecond) {
+    messageRate = messagesPerSecond > 0 ? messagesPerSecond : 0;
+    byteRate = bytesPerSecond;
+
+    // Start with a full bucket so the first burst is not delayed
+    messageCredits = messageRate < 1 ? 1 : messageRate;
+    byteCredits = byteRate;
+    lastCreditRefill = millis();
+}
+
+PublishResult FastIoT::getLastPublishResult() {
+    return lastPublishResult;
+}
+
+String FastIoT::buildChannelPayload(ChannelUpdate updates[], size_t count) {
+    // Room for a window summary object per channel when many are sent together
+    DynamicJsonDocument doc(count > 4 ? count * 256 : 1024);
+    doc["id"] = deviceId.toInt();
+
+    JsonArray channels = doc.createNestedArray("channels");
+
+    for (size_t i = 0; i < count; i++) {
+        JsonObject chanObj = channels.createNestedObject();
+        chanObj["name"] = updates[i].name;
+        chanObj["value"] = updates[i].value;
+    }
+
+    String payload;
+    serializeJson(doc, payload);
+    return payload;
+}
+
+PublishResult FastIoT::publishPayload(const String &payload, bool blocking) {
+    if (!mqttClient.connected()) {
+        lastPublishResult = PUBLISH_NOT_CONNECTED;
+        return lastPublishResult;
+    }
+
+    // Publishing from a streamed update or payload sink would build the outgoing packet
+    // in the buffer the MQTT client is still reading into
+    if (receivingStream) {
+        lastPublishResult = PUBLISH_WOULD_BLOCK;
+        return lastPublishResult;
+    }
+
+    // Same limit the MQTT client applies before building the packet
+    bool fitsBuffer = MQTT_MAX_HEADER_SIZE + 2 + FASTIOT_PUBLISH_PROPERTIES_SIZE + updateTopic.length() + payload.length() <= mqttClient.getBufferSize();
+    if (!fitsBuffer && !blocking) {
+        lastPublishResult = PUBLISH_TOO_LARGE;
+        return lastPublishResult;
+    }
+
+    // Remaining length: topic length prefix, topic, MQTT 5 properties and payload (QoS 0, no packet id).
+    // With a topic alias in use the real packet is smaller, so this errs on the safe side.
+    size_t remaining = 2 + FASTIOT_PUBLISH_PROPERTIES_SIZE + updateTopic.length() + payload.length();
+    size_t packetLength = 2 + remaining;
+    for (size_t left = remaining >> 7; left > 0; left >>= 7) {
+        packetLength++;
+    }
+
+    refillPublishCredits();
+
+    if (!blocking) {
+        size_t byteCost = (byteRate > 0 && packetLength > byteRate) ? byteRate : packetLength;
+        if ((messageRate > 0 && messageCredits < 1) || (byteRate > 0 && byteCredits < byteCost)) {
+            lastPublishResult = PUBLISH_RATE_LIMITED;
+            return lastPublishResult;
+        }
+        if (getTxBufferFree() < packetLength) {
+            lastPublishResult = PUBLISH_WOULD_BLOCK;
+            return lastPublishResult;
+        }
+    }
+
+    bool sent;
+    if (fitsBuffer) {
+        sent = mqttClient.publish(updateTopic.c_str(), payload.c_str());
+    } else {
+        // Too big for the packet buffer: write the payload straight to the socket
+        sent = mqttClient.beginPublish(updateTopic.c_str(), payload.length(), false) &&
+               mqttClient.write((const uint8_t*)payload.c_str(), payload.length()) == payload.length() &&
+               mqttClient.endPublish();
+    }
+
+    if (!sent) {
+        lastPublishResult = PUBLISH_FAILED;
+        return lastPublishResult;
+    }
+
+    // Blocking publishes are charged too, so mixing both modes stays within budget
+    if (messageRate > 0) {
+        messageCredits -= 1;
+    }
+    if (byteRate > 0) {
+        byteCredits -= packetLength;
+    }
+
+    lastPublishResult = PUBLISH_OK;
+    return lastPublishResult;
+}
+
+void FastIoT::refillPublishCredits() {
+    unsigned long now = millis();
+    float elapsed = (now - lastCreditRefill) / 1000.0f;
+    lastCreditRefill = now;
+
+    // Bucket depth is one second of budget (at least one message)
+    float messageCapacity = messageRate < 1 ? 1 : messageRate;
+    messageCredits += elapsed * messageRate;
+    if (messageCredits > messageCapacity) {
+        messageCredits = messageCapacity;
+    }
+
+    byteCredits += elapsed * byteRate;
+    if (byteCredits > byteRate) {
+        byteCredits = byteRate;
+    }
+}
+
+void FastIoT::loop() {
+    if (!mqttClient.connected()) {
+        Serial.println("MQTT connection lost. Attempting to reconnect...");
+        if (connectMQTT()) {
+            Serial.println("MQTT reconnected successfully.");
+        } else {
+            delay(5000);
+        }
+    }
+    if (trackCount > 0 && millis() - lastTrackUpload >= trackInterval) {
+        flushLocationTrack();
+    }
+    if (channelAggregates != nullptr) {
+        publishAggregates();
+    }
+    if (edgeRuleCount > 0 && mqttClient.connected()) {
+        reportPendingRules();
+    }
+
+    // Drop leftovers of a PUBLISH that was cut off before its callback ran
+    resetPayloadStream();
+    mqttClient.loop();
+}
+
+bool FastIoT::isConnected() {
+    return mqttClient.connected();
+}
+
+#if defined(FASTIOT_MQTT5)
+void FastIoT::setSessionExpiry(uint32_t seconds) {
+    mqttClient.setSessionExpiry(seconds);
+}
+
+void FastIoT::setReceiveMaximum(uint16_t count) {
+    mqttClient.setReceiveMaximum(count);
+}
+#endif
+
+void FastIoT::disconnect() {
+    mqttClient.disconnect();
+    Serial.println("Disconnected from MQTT broker");
+}
+
+String FastIoT::getDeviceTopic() {
+    return topic;
+}
+
+String FastIoT::getUpdateTopic() {
+    return updateTopic;
+}
+
+void FastIoT::processChannelMessage(String message) {
+    DynamicJsonDocument doc(1024);
+    DeserializationError error = deserializeJson(doc, message);
+
+    // Rule sets are larger than channel updates: retry with room for FASTIOT_MAX_RULES rules
+    if (error == DeserializationError::NoMemory) {
+        doc = DynamicJsonDocument(ruleDocumentSize(message.length()));
+        error = deserializeJson(doc, message);
+    }
+    
+    if (error) {
+        Serial.println("Failed to parse message JSON: " + String(error.c_str()));
+        return;
+    }
+
+    if (doc.is<JsonArray>()) {
+        JsonArray arr = doc.as<JsonArray>();
+        for (JsonObject obj : arr) {
+            if (obj.containsKey("name") && obj.containsKey("value")) {
+                dispatchChannelUpdate(obj["name"], obj["value"]);
+            }
+        }
+    } else if (doc.is<JsonObject>()) {
+        if (doc.containsKey("name") && doc.containsKey("value")) {
+            dispatchChannelUpdate(doc["name"], doc["value"]);
+        } else if (doc.containsKey("rules")) {
+            compileRules(doc["rules"]);
+        }
+    } else {
+        Serial.println("Invalid message format");
+    }
+}
+
+void FastIoT::dispatchChannelUpdate(String name, JsonVariant value) {
+    Serial.println("Channel update - " + name + ": " + value.as<String>());
+
+    ChannelCallback* current = channelCallbacks;
+    while (current != nullptr) {
+        if (current->name == name && current->callback != nullptr) {
+            current->callback(name, value);
+            break;
+        }
+        current = current->next;
+    }
+
+    evaluateRules(name, value, RULE_REPORT_DEFERRED);
+}
+
+size_t FastIoT::PayloadStream::write(uint8_t b) {
+    // Called while the MQTT client is still reading the packet into its buffer
+    owner->receivingStream = true;
+    owner->receivePayloadByte(b);
+    owner->receivingStream = false;
+    return 1;
+}
+
+int FastIoT::PayloadStream::available() {
+    return 0;
+}
+
+int FastIoT::PayloadStream::read() {
+    return -1;
+}
+
+int FastIoT::PayloadStream::peek() {
+    return -1;
+}
+
+void FastIoT::receivePayloadByte(uint8_t b) {
+    if (!streamOverflowed) {
+        if (streamFill < streamWindowSize) {
+            streamWindow[streamFill++] = b;
+            return;
+        }
+
+        // Larger than the window: PubSubClient will only deliver a truncated copy,
+        // so hand what we have on now and keep going chunk by chunk
+        streamOverflowed = true;
+        if (payloadSink != nullptr) {
+            payloadSink(streamWindow, streamFill, 0, false);
+            streamOffset = streamFill;
+            streamFill = 0;
+        } else {
+            // Re-decoding in place is safe: an element never grows faster than it is read
+            size_t buffered = streamFill;
+            streamFill = 0;
+            for (size_t i = 0; i < buffered; i++) {
+                decodePayloadByte(streamWindow[i]);
+            }
+        }
+    }
+
+    if (payloadSink != nullptr) {
+        streamWindow[streamFill++] = b;
+        if (streamFill == streamWindowSize) {
+            payloadSink(streamWindow, streamFill, streamOffset, false);
+            streamOffset += streamFill;
+            streamFill = 0;
+        }
+    } else {
+        decodePayloadByte(b);
+    }
+}
+
+void FastIoT::decodePayloadByte(uint8_t b) {
+    if (decodeFailed) {
+        return;
+    }
+
+    // Outside the channel array
+    if (decodeDepth == 0) {
+        if (b == '[') {
+            decodeDepth = 1;
+        } else if (!isspace(b)) {
+            decodeFailed = true;
+            Serial.println("Streamed payload is not a channel array");
+        }
+        return;
+    }
+
+    // Between elements: only an object opens a new channel update
+    if (decodeDepth == 1) {
+        if (b == '{') {
+            decodeDepth = 2;
+            decodeSkipping = false;
+            streamFill = 0;
+            streamWindow[streamFill++] = b;
+        } else if (b == ']') {
+            decodeDepth = 0;
+        }
+        return;
+    }
+
+    if (!decodeSkipping) {
+        if (streamFill < streamWindowSize) {
+            streamWindow[streamFill++] = b;
+        } else {
+            decodeSkipping = true;
+            Serial.println("Dropping streamed channel update larger than the window");
+        }
+    }
+
+    if (decodeInString) {
+        if (decodeEscape) {
+            decodeEscape = false;
+        } else if (b == '\\') {
+            decodeEscape = true;
+        } else if (b == '"') {
+            decodeInString = false;
+        }
+        return;
+    }
+
+    if (b == '"') {
+        decodeInString = true;
+    } else if (b == '{' || b == '[') {
+        decodeDepth++;
+    } else if (b == '}' || b == ']') {
+        decodeDepth--;
+        if (decodeDepth == 1) {
+            if (!decodeSkipping) {
+                DynamicJsonDocument doc(1024);
+                DeserializationError error = deserializeJson(doc, (const char*)streamWindow, streamFill);
+                if (error) {
+                    Serial.println("Failed to parse streamed channel update: " + String(error.c_str()));
+                } else if (doc.containsKey("name") && doc.containsKey("value")) {
+                    dispatchChannelUpdate(doc["name"], doc["value"]);
+                }
+            }
+            streamFill = 0;
+        }
+    }
+}
+
+void FastIoT::finishStreamedPayload(String topic) {
+    if (payloadSink != nullptr) {
+        payloadSink(streamWindow, streamFill, streamOffset, true);
+        Serial.println("Received streamed message on " + topic + ": " + String(streamOffset + streamFill) + " bytes");
+    } else if (decodeDepth != 0 || decodeFailed) {
+        Serial.println("Streamed channel array on " + topic + " was incomplete or invalid");
+    } else {
+        Serial.println("Received streamed channel array on " + topic);
+    }
+
+    streamOverflowed = false;
+    resetPayloadStream();
+}
+
+void FastIoT::resetPayloadStream() {
+    if (streamOverflowed) {
+        Serial.println("Streamed payload was cut off, discarding");
+        if (payloadSink != nullptr) {
+            payloadSink(nullptr, 0, streamOffset + streamFill, false);
+        }
+    }
+
+    streamFill = 0;
+    streamOffset = 0;
+    streamOverflowed = false;
+    decodeDepth = 0;
+    decodeInString = false;
+    decodeEscape = false;
+    decodeSkipping = false;
+    decodeFailed = false;
+}
+
+// Static callback function
+void FastIoT::internalCallback(char* topic, byte* payload, unsigned int length) {
+    String topicStr = String(topic);
+
+    if (instance && instance->streamWindow != nullptr) {
+        // Oversized payloads were already handed out chunk by chunk
+        if (instance->streamOverflowed) {
+            instance->finishStreamedPayload(topicStr);
+            return;
+        }
+
+        // PubSubClient truncates payloads that overrun its buffer; the window has all of it
+        if (instance->streamFill > length) {
+            payload = instance->streamWindow;
+            length = instance->streamFill;
+        }
+    }
+
+    // Convert payload to string
+    String message = "";
+    for (unsigned int i = 0; i < length; i++) {
+        message += (char)payload[i];
+    }
+
+    // The transport may deliver several messages per loop: start the next one with an empty window
+    if (instance && instance->streamWindow != nullptr) {
+        instance->resetPayloadStream();
+    }
+    
+    Serial.println("Received message on " + topicStr + ": " + message);
+    
+    // Process channel-specific callbacks first
+    if (instance) {
+        instance->processChannelMessage(message);
+    }
+    
+    // Call general message callback if set
+    if (instance && instance->messageCallback) {
+        instance->messageCallback(topicStr, message);
+    }
+}
\ No newline at end of file
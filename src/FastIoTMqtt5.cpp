@@ -0,0 +1,767 @@
+#include "FastIoTMqtt5.h"
+
+#if defined(FASTIOT_MQTT5)
+
+static const uint8_t MQTT5_CONNECT = 0x10;
+static const uint8_t MQTT5_CONNACK = 0x20;
+static const uint8_t MQTT5_PUBLISH = 0x30;
+static const uint8_t MQTT5_PUBACK = 0x40;
+static const uint8_t MQTT5_SUBSCRIBE = 0x82;
+static const uint8_t MQTT5_PINGREQ = 0xC0;
+static const uint8_t MQTT5_PINGRESP = 0xD0;
+static const uint8_t MQTT5_DISCONNECT = 0xE0;
+
+static const uint8_t PROPERTY_SESSION_EXPIRY = 0x11;
+static const uint8_t PROPERTY_SERVER_KEEP_ALIVE = 0x13;
+static const uint8_t PROPERTY_RECEIVE_MAXIMUM = 0x21;
+static const uint8_t PROPERTY_TOPIC_ALIAS_MAXIMUM = 0x22;
+static const uint8_t PROPERTY_TOPIC_ALIAS = 0x23;
+static const uint8_t PROPERTY_MAXIMUM_PACKET_SIZE = 0x27;
+
+static size_t varIntSize(uint32_t value) {
+    size_t size = 1;
+    while (value >= 128) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static size_t writeVarInt(uint8_t *out, uint32_t value) {
+    size_t size = 0;
+    do {
+        uint8_t digit = value & 0x7F;
+        value >>= 7;
+        if (value > 0) {
+            digit |= 0x80;
+        }
+        out[size++] = digit;
+    } while (value > 0);
+    return size;
+}
+
+static size_t writeUint16(uint8_t *out, uint16_t value) {
+    out[0] = value >> 8;
+    out[1] = value & 0xFF;
+    return 2;
+}
+
+static size_t writeUint32(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = (value >> 16) & 0xFF;
+    out[2] = (value >> 8) & 0xFF;
+    out[3] = value & 0xFF;
+    return 4;
+}
+
+static size_t writeString(uint8_t *out, const char *value, size_t length) {
+    writeUint16(out, length);
+    memcpy(out + 2, value, length);
+    return length + 2;
+}
+
+static bool decodeVarInt(const uint8_t *&p, const uint8_t *end, uint32_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 28; shift += 7) {
+        if (p >= end) {
+            return false;
+        }
+        uint8_t digit = *p++;
+        value |= (uint32_t)(digit & 0x7F) << shift;
+        if ((digit & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Decodes one property. Integer values are returned in value, strings and binary data are skipped.
+static bool readProperty(const uint8_t *&p, const uint8_t *end, uint8_t &id, uint32_t &value) {
+    if (p >= end) {
+        return false;
+    }
+    id = *p++;
+    value = 0;
+
+    size_t size;
+    switch (id) {
+        case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+            size = 1;
+            break;
+        case 0x13: case 0x21: case 0x22: case 0x23:
+            size = 2;
+            break;
+        case 0x02: case 0x11: case 0x18: case 0x27:
+            size = 4;
+            break;
+        case 0x0B:
+            return decodeVarInt(p, end, value);
+        case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+        case 0x26: {
+            // Length-prefixed string or binary data; user properties are a pair of strings
+            int strings = id == 0x26 ? 2 : 1;
+            for (int i = 0; i < strings; i++) {
+                if (end - p < 2) {
+                    return false;
+                }
+                size_t length = (p[0] << 8) | p[1];
+                if ((size_t)(end - p) < length + 2) {
+                    return false;
+                }
+                p += length + 2;
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+
+    if ((size_t)(end - p) < size) {
+        return false;
+    }
+    for (size_t i = 0; i < size; i++) {
+        value = (value << 8) | *p++;
+    }
+    return true;
+}
+
+FastIoTMqtt5::FastIoTMqtt5(Client &client) {
+    this->client = &client;
+    stream = nullptr;
+    callback = nullptr;
+    host = nullptr;
+    port = 1883;
+    connectionState = DISCONNECTED;
+    session = false;
+    sessionExpiry = 0;
+    receiveMaximum = FASTIOT_MQTT5_MAX_PENDING_ACKS;
+    keepAlive = FASTIOT_MQTT5_KEEPALIVE;
+    nextPacketId = 0;
+    pingOutstanding = false;
+    lastInActivity = 0;
+    lastOutActivity = 0;
+    serverMaximumPacketSize = 0;
+    serverTopicAliasMaximum = 0;
+    pendingAckCount = 0;
+}
+
+FastIoTMqtt5::~FastIoTMqtt5() {
+}
+
+FastIoTMqtt5 &FastIoTMqtt5::setServer(const char *host, uint16_t port) {
+    this->host = host;
+    this->port = port;
+    return *this;
+}
+
+FastIoTMqtt5 &FastIoTMqtt5::setCallback(void (*callback)(char *topic, uint8_t *payload, unsigned int length)) {
+    this->callback = callback;
+    return *this;
+}
+
+FastIoTMqtt5 &FastIoTMqtt5::setStream(Stream &stream) {
+    this->stream = &stream;
+    return *this;
+}
+
+uint16_t FastIoTMqtt5::getBufferSize() {
+    return sizeof(buffer);
+}
+
+void FastIoTMqtt5::setSessionExpiry(uint32_t seconds) {
+    sessionExpiry = seconds;
+}
+
+void FastIoTMqtt5::setReceiveMaximum(uint16_t count) {
+    if (count == 0) {
+        count = 1;
+    } else if (count > FASTIOT_MQTT5_MAX_PENDING_ACKS) {
+        count = FASTIOT_MQTT5_MAX_PENDING_ACKS;
+    }
+    receiveMaximum = count;
+}
+
+bool FastIoTMqtt5::connect(const char *id, const char *user, const char *pass) {
+    if (connected()) {
+        return true;
+    }
+
+    if (!client->connect(host, port)) {
+        connectionState = CONNECT_FAILED;
+        return false;
+    }
+
+    uint8_t properties[24];
+    size_t propertiesLength = 0;
+    if (sessionExpiry > 0) {
+        properties[propertiesLength++] = PROPERTY_SESSION_EXPIRY;
+        propertiesLength += writeUint32(properties + propertiesLength, sessionExpiry);
+    }
+    properties[propertiesLength++] = PROPERTY_RECEIVE_MAXIMUM;
+    propertiesLength += writeUint16(properties + propertiesLength, receiveMaximum);
+    if (stream == nullptr) {
+        // Let the broker drop what we could not receive instead of sending it over the air
+        properties[propertiesLength++] = PROPERTY_MAXIMUM_PACKET_SIZE;
+        propertiesLength += writeUint32(properties + propertiesLength, sizeof(buffer));
+    }
+    properties[propertiesLength++] = PROPERTY_TOPIC_ALIAS_MAXIMUM;
+    propertiesLength += writeUint16(properties + propertiesLength, FASTIOT_MQTT5_TOPIC_ALIASES);
+
+    size_t idLength = strlen(id);
+    size_t userLength = user != nullptr ? strlen(user) : 0;
+    size_t passLength = pass != nullptr ? strlen(pass) : 0;
+    uint32_t remaining = 10 + varIntSize(propertiesLength) + propertiesLength + 2 + idLength;
+    if (user != nullptr) {
+        remaining += 2 + userLength;
+    }
+    if (pass != nullptr) {
+        remaining += 2 + passLength;
+    }
+    if (1 + varIntSize(remaining) + remaining > sizeof(buffer)) {
+        connectionState = CONNECT_FAILED;
+        client->stop();
+        return false;
+    }
+
+    // A session is only worth resuming when the broker keeps it after we disconnect
+    uint8_t flags = sessionExpiry > 0 ? 0x00 : 0x02;
+    if (user != nullptr) {
+        flags |= 0x80;
+    }
+    if (pass != nullptr) {
+        flags |= 0x40;
+    }
+
+    size_t length = 0;
+    buffer[length++] = MQTT5_CONNECT;
+    length += writeVarInt(buffer + length, remaining);
+    length += writeString(buffer + length, "MQTT", 4);
+    buffer[length++] = 5;
+    buffer[length++] = flags;
+    length += writeUint16(buffer + length, FASTIOT_MQTT5_KEEPALIVE);
+    length += writeVarInt(buffer + length, propertiesLength);
+    memcpy(buffer + length, properties, propertiesLength);
+    length += propertiesLength;
+    length += writeString(buffer + length, id, idLength);
+    if (user != nullptr) {
+        length += writeString(buffer + length, user, userLength);
+    }
+    if (pass != nullptr) {
+        length += writeString(buffer + length, pass, passLength);
+    }
+
+    client->write(buffer, length);
+    lastOutActivity = millis();
+
+    uint8_t header;
+    uint32_t connackLength;
+    if (!readByte(header)) {
+        connectionState = CONNECTION_TIMEOUT;
+        client->stop();
+        return false;
+    }
+    if ((header & 0xF0) != MQTT5_CONNACK || !readVarInt(connackLength) || !readPacketBody(connackLength)) {
+        connectionState = CONNECT_FAILED;
+        client->stop();
+        return false;
+    }
+
+    parseConnack(connackLength);
+    if (connectionState != CONNECTED) {
+        client->stop();
+        return false;
+    }
+    return true;
+}
+
+void FastIoTMqtt5::parseConnack(uint32_t length) {
+    if (length < 2) {
+        connectionState = CONNECT_FAILED;
+        return;
+    }
+
+    session = buffer[0] & 0x01;
+    connectionState = buffer[1];
+    serverMaximumPacketSize = 0;
+    serverTopicAliasMaximum = 0;
+    keepAlive = FASTIOT_MQTT5_KEEPALIVE;
+
+    const uint8_t *p = buffer + 2;
+    const uint8_t *end = buffer + length;
+    uint32_t propertiesLength;
+    if (length > 2 && decodeVarInt(p, end, propertiesLength) && propertiesLength <= (uint32_t)(end - p)) {
+        end = p + propertiesLength;
+        uint8_t id;
+        uint32_t value;
+        while (readProperty(p, end, id, value)) {
+            if (id == PROPERTY_MAXIMUM_PACKET_SIZE) {
+                serverMaximumPacketSize = value;
+            } else if (id == PROPERTY_TOPIC_ALIAS_MAXIMUM) {
+                serverTopicAliasMaximum = value;
+            } else if (id == PROPERTY_SERVER_KEEP_ALIVE) {
+                keepAlive = value;
+            }
+        }
+    }
+
+    // Aliases only live as long as the network connection
+    for (int i = 0; i < FASTIOT_MQTT5_TOPIC_ALIASES; i++) {
+        outboundAliases[i] = "";
+        inboundAliases[i] = "";
+    }
+    pendingAckCount = 0;
+    pingOutstanding = false;
+    lastInActivity = millis();
+    lastOutActivity = lastInActivity;
+}
+
+bool FastIoTMqtt5::connected() {
+    bool rc = client->connected();
+    if (!rc) {
+        if (connectionState == CONNECTED) {
+            connectionState = CONNECTION_LOST;
+            client->flush();
+            client->stop();
+        }
+        return false;
+    }
+    return connectionState == CONNECTED;
+}
+
+bool FastIoTMqtt5::sessionPresent() {
+    return session;
+}
+
+int FastIoTMqtt5::state() {
+    return connectionState;
+}
+
+void FastIoTMqtt5::disconnect() {
+    // Normal disconnection: the broker keeps the session for sessionExpiry seconds
+    uint8_t packet[2] = { MQTT5_DISCONNECT, 0 };
+    client->write(packet, 2);
+    connectionState = DISCONNECTED;
+    client->flush();
+    client->stop();
+    lastInActivity = millis();
+    lastOutActivity = lastInActivity;
+}
+
+bool FastIoTMqtt5::subscribe(const char *topic, uint8_t qos) {
+    if (!connected() || qos > 1) {
+        return false;
+    }
+
+    size_t topicLength = strlen(topic);
+    uint32_t remaining = 2 + 1 + 2 + topicLength + 1;
+    if (1 + varIntSize(remaining) + remaining > sizeof(buffer)) {
+        return false;
+    }
+
+    nextPacketId++;
+    if (nextPacketId == 0) {
+        nextPacketId = 1;
+    }
+
+    size_t length = 0;
+    buffer[length++] = MQTT5_SUBSCRIBE;
+    length += writeVarInt(buffer + length, remaining);
+    length += writeUint16(buffer + length, nextPacketId);
+    buffer[length++] = 0;  // no properties
+    length += writeString(buffer + length, topic, topicLength);
+    buffer[length++] = qos;
+
+    lastOutActivity = millis();
+    return client->write(buffer, length) == length;
+}
+
+bool FastIoTMqtt5::publish(const char *topic, const char *payload) {
+    return publish(topic, (const uint8_t*)payload, strlen(payload));
+}
+
+bool FastIoTMqtt5::publish(const char *topic, const uint8_t *payload, unsigned int length) {
+    if (!connected()) {
+        return false;
+    }
+
+    // Same limit FastIoT checks before choosing between publish() and beginPublish()
+    if (MQTT_MAX_HEADER_SIZE + 2 + FASTIOT_MQTT5_PUBLISH_PROPERTIES_SIZE + strlen(topic) + length > sizeof(buffer)) {
+        return false;
+    }
+
+    uint32_t packetLength;
+    uint16_t newAlias;
+    size_t headerLength = writePublishHeader(topic, length, false, packetLength, newAlias);
+    if (headerLength == 0) {
+        return false;
+    }
+    memcpy(buffer + headerLength, payload, length);
+
+    lastOutActivity = millis();
+    if (client->write(buffer, packetLength) != packetLength) {
+        return false;
+    }
+    if (newAlias > 0) {
+        outboundAliases[newAlias - 1] = topic;
+    }
+    return true;
+}
+
+bool FastIoTMqtt5::beginPublish(const char *topic, unsigned int length, bool retained) {
+    if (!connected()) {
+        return false;
+    }
+
+    uint32_t packetLength;
+    uint16_t newAlias;
+    size_t headerLength = writePublishHeader(topic, length, retained, packetLength, newAlias);
+    if (headerLength == 0) {
+        return false;
+    }
+
+    lastOutActivity = millis();
+    if (client->write(buffer, headerLength) != headerLength) {
+        return false;
+    }
+    if (newAlias > 0) {
+        outboundAliases[newAlias - 1] = topic;
+    }
+    return true;
+}
+
+size_t FastIoTMqtt5::write(const uint8_t *data, size_t size) {
+    lastOutActivity = millis();
+    return client->write(data, size);
+}
+
+int FastIoTMqtt5::endPublish() {
+    return connected() ? 1 : 0;
+}
+
+// Writes the fixed and variable header of a QoS 0 PUBLISH into the buffer.
+// Returns its length, or 0 when the broker would reject the packet.
+// newAlias is the alias this header sets up; the caller records it once the header is written
+size_t FastIoTMqtt5::writePublishHeader(const char *topic, uint32_t payloadLength, bool retained, uint32_t &packetLength, uint16_t &newAlias) {
+    size_t topicLength = strlen(topic);
+
+    // Reuse the alias of a known topic, or claim a free one and send the topic once more
+    int aliasLimit = serverTopicAliasMaximum < FASTIOT_MQTT5_TOPIC_ALIASES ? serverTopicAliasMaximum : FASTIOT_MQTT5_TOPIC_ALIASES;
+    uint16_t alias = 0;
+    uint16_t freeAlias = 0;
+    for (int i = 0; i < aliasLimit; i++) {
+        if (outboundAliases[i] == topic) {
+            alias = i + 1;
+            break;
+        }
+        if (freeAlias == 0 && outboundAliases[i].length() == 0) {
+            freeAlias = i + 1;
+        }
+    }
+    bool sendTopic = alias == 0;
+    if (alias == 0) {
+        alias = freeAlias;
+    }
+
+    newAlias = sendTopic ? alias : 0;
+
+    size_t sentTopicLength = sendTopic ? topicLength : 0;
+    size_t propertiesLength = alias > 0 ? 3 : 0;
+    uint32_t remaining = 2 + sentTopicLength + 1 + propertiesLength + payloadLength;
+    packetLength = 1 + varIntSize(remaining) + remaining;
+    if (packetLength - payloadLength > sizeof(buffer) ||
+        (serverMaximumPacketSize > 0 && packetLength > serverMaximumPacketSize)) {
+        return 0;
+    }
+
+    size_t length = 0;
+    buffer[length++] = MQTT5_PUBLISH | (retained ? 0x01 : 0x00);
+    length += writeVarInt(buffer + length, remaining);
+    length += writeString(buffer + length, topic, sentTopicLength);
+    buffer[length++] = propertiesLength;
+    if (alias > 0) {
+        buffer[length++] = PROPERTY_TOPIC_ALIAS;
+        length += writeUint16(buffer + length, alias);
+    }
+    return length;
+}
+
+bool FastIoTMqtt5::loop() {
+    if (!connected()) {
+        return false;
+    }
+
+    unsigned long now = millis();
+    unsigned long interval = keepAlive * 1000UL;
+    if (keepAlive > 0 && (now - lastInActivity > interval || now - lastOutActivity > interval)) {
+        if (pingOutstanding) {
+            connectionState = CONNECTION_TIMEOUT;
+            client->stop();
+            return false;
+        }
+        uint8_t ping[2] = { MQTT5_PINGREQ, 0 };
+        client->write(ping, 2);
+        lastOutActivity = now;
+        lastInActivity = now;
+        pingOutstanding = true;
+    }
+
+    // Handle what has arrived, up to the receive maximum, then acknowledge it in one write
+    for (uint16_t i = 0; i < receiveMaximum && client->available(); i++) {
+        if (!handlePacket()) {
+            break;
+        }
+    }
+    flushAcks();
+
+    return connected();
+}
+
+bool FastIoTMqtt5::handlePacket() {
+    uint8_t header;
+    uint32_t length;
+    if (!readByte(header) || !readVarInt(length)) {
+        connectionState = CONNECTION_LOST;
+        client->stop();
+        return false;
+    }
+    lastInActivity = millis();
+
+    uint8_t type = header & 0xF0;
+    if (type == MQTT5_PUBLISH) {
+        return handlePublish(header, length);
+    }
+
+    // Control packets we do not need to look into may be larger than the buffer
+    if (length > sizeof(buffer)) {
+        return skipBytes(length);
+    }
+    if (!readPacketBody(length)) {
+        connectionState = CONNECTION_LOST;
+        client->stop();
+        return false;
+    }
+
+    if (type == MQTT5_PINGRESP) {
+        pingOutstanding = false;
+    } else if (type == MQTT5_DISCONNECT) {
+        connectionState = (length > 0 && buffer[0] != 0) ? buffer[0] : (int)CONNECTION_LOST;
+        client->stop();
+        return false;
+    }
+    return true;
+}
+
+bool FastIoTMqtt5::handlePublish(uint8_t header, uint32_t remaining) {
+    uint8_t qos = (header >> 1) & 0x03;
+    uint8_t high;
+    uint8_t low;
+    if (remaining < 3 || !readByte(high) || !readByte(low)) {
+        connectionState = CONNECTION_LOST;
+        client->stop();
+        return false;
+    }
+
+    size_t topicLength = (high << 8) | low;
+    uint32_t consumed = 2;
+    if (topicLength + 1 > sizeof(buffer)) {
+        // Topic too long for the buffer: drop the message, but free its receive maximum slot
+        if (qos == 0) {
+            return skipBytes(remaining - consumed);
+        }
+        if (remaining < consumed + topicLength + 2 || !skipBytes(topicLength) || !readByte(high) || !readByte(low)) {
+            connectionState = CONNECTION_LOST;
+            client->stop();
+            return false;
+        }
+        consumed += topicLength + 2;
+        if (!skipBytes(remaining - consumed)) {
+            return false;
+        }
+        queueAck((high << 8) | low);
+        return true;
+    }
+    for (size_t i = 0; i < topicLength; i++) {
+        if (!readByte(buffer[i])) {
+            connectionState = CONNECTION_LOST;
+            client->stop();
+            return false;
+        }
+    }
+    buffer[topicLength] = 0;
+    consumed += topicLength;
+
+    uint16_t packetId = 0;
+    if (qos > 0) {
+        if (!readByte(high) || !readByte(low)) {
+            connectionState = CONNECTION_LOST;
+            client->stop();
+            return false;
+        }
+        packetId = (high << 8) | low;
+        consumed += 2;
+    }
+
+    // Properties are read in behind the topic and only the topic alias is kept
+    uint32_t propertiesLength;
+    if (!readVarInt(propertiesLength)) {
+        connectionState = CONNECTION_LOST;
+        client->stop();
+        return false;
+    }
+    consumed += varIntSize(propertiesLength);
+    if (consumed + propertiesLength > remaining) {
+        connectionState = CONNECTION_LOST;
+        client->stop();
+        return false;
+    }
+    if (topicLength + 1 + propertiesLength > sizeof(buffer)) {
+        // Too many properties to look at: drop the message, but still acknowledge it
+        if (!skipBytes(remaining - consumed)) {
+            return false;
+        }
+        if (qos == 1) {
+            queueAck(packetId);
+        }
+        return true;
+    }
+    consumed += propertiesLength;
+    uint8_t *properties = buffer + topicLength + 1;
+    for (uint32_t i = 0; i < propertiesLength; i++) {
+        if (!readByte(properties[i])) {
+            connectionState = CONNECTION_LOST;
+            client->stop();
+            return false;
+        }
+    }
+
+    uint16_t alias = 0;
+    const uint8_t *p = properties;
+    uint8_t id;
+    uint32_t value;
+    while (readProperty(p, properties + propertiesLength, id, value)) {
+        if (id == PROPERTY_TOPIC_ALIAS) {
+            alias = value;
+        }
+    }
+
+    bool deliver = true;
+    if (alias > 0 && alias <= FASTIOT_MQTT5_TOPIC_ALIASES) {
+        if (topicLength > 0) {
+            inboundAliases[alias - 1] = (const char*)buffer;
+        } else if (inboundAliases[alias - 1].length() > 0 && inboundAliases[alias - 1].length() + 1 <= sizeof(buffer)) {
+            topicLength = inboundAliases[alias - 1].length();
+            memcpy(buffer, inboundAliases[alias - 1].c_str(), topicLength + 1);
+        } else {
+            deliver = false;
+        }
+    } else if (topicLength == 0) {
+        // Empty topic without a usable alias is a protocol error: drop it, the PUBACK still goes out
+        deliver = false;
+    }
+
+    // Payload goes to the stream in full and into the buffer as far as it fits
+    uint32_t payloadLength = remaining - consumed;
+    uint8_t *payload = buffer + topicLength + 1;
+    size_t capacity = sizeof(buffer) - topicLength - 1;
+    size_t stored = 0;
+    for (uint32_t i = 0; i < payloadLength; i++) {
+        uint8_t b;
+        if (!readByte(b)) {
+            connectionState = CONNECTION_LOST;
+            client->stop();
+            return false;
+        }
+        if (stream != nullptr && deliver) {
+            stream->write(b);
+        }
+        if (stored < capacity) {
+            payload[stored++] = b;
+        }
+    }
+
+    if (qos == 1) {
+        queueAck(packetId);
+    }
+
+    // Without a stream, payloads that did not fit are dropped like PubSubClient does
+    if (deliver && callback != nullptr && (stream != nullptr || stored == payloadLength)) {
+        callback((char*)buffer, payload, stored);
+    }
+    return true;
+}
+
+void FastIoTMqtt5::queueAck(uint16_t packetId) {
+    if (pendingAckCount == FASTIOT_MQTT5_MAX_PENDING_ACKS) {
+        flushAcks();
+    }
+    pendingAcks[pendingAckCount++] = packetId;
+}
+
+void FastIoTMqtt5::flushAcks() {
+    if (pendingAckCount == 0) {
+        return;
+    }
+
+    uint8_t packets[FASTIOT_MQTT5_MAX_PENDING_ACKS * 4];
+    for (uint8_t i = 0; i < pendingAckCount; i++) {
+        packets[i * 4] = MQTT5_PUBACK;
+        packets[i * 4 + 1] = 2;  // packet id only, reason code 0 is implied
+        writeUint16(packets + i * 4 + 2, pendingAcks[i]);
+    }
+    client->write(packets, pendingAckCount * 4);
+    lastOutActivity = millis();
+    pendingAckCount = 0;
+}
+
+bool FastIoTMqtt5::readByte(uint8_t &value) {
+    unsigned long start = millis();
+    while (!client->available()) {
+        if (!client->connected() || millis() - start >= FASTIOT_MQTT5_SOCKET_TIMEOUT * 1000UL) {
+            return false;
+        }
+        yield();
+    }
+    value = client->read();
+    return true;
+}
+
+bool FastIoTMqtt5::readVarInt(uint32_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 28; shift += 7) {
+        uint8_t digit;
+        if (!readByte(digit)) {
+            return false;
+        }
+        value |= (uint32_t)(digit & 0x7F) << shift;
+        if ((digit & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FastIoTMqtt5::skipBytes(uint32_t count) {
+    uint8_t b;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!readByte(b)) {
+            connectionState = CONNECTION_LOST;
+            client->stop();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FastIoTMqtt5::readPacketBody(uint32_t length) {
+    if (length > sizeof(buffer)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        if (!readByte(buffer[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
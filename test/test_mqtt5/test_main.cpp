@@ -0,0 +1,299 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "FastIoTMqtt5.h"
+
+// Checks the packets FastIoTMqtt5 puts on the wire against a scripted client.
+// Needs no network or broker: build with -D FASTIOT_MQTT5 and run `pio test -f test_mqtt5`.
+
+#if !defined(FASTIOT_MQTT5)
+#error "Build the MQTT 5 tests with -D FASTIOT_MQTT5"
+#endif
+
+// The expected CONNECT below announces the default limits
+#if FASTIOT_MQTT5_BUFFER_SIZE != 256 || FASTIOT_MQTT5_TOPIC_ALIASES != 2 || FASTIOT_MQTT5_MAX_PENDING_ACKS != 8 || FASTIOT_MQTT5_KEEPALIVE != 15
+#error "The MQTT 5 tests expect the default FASTIOT_MQTT5_* settings"
+#endif
+
+// Replays bytes queued by the test as broker traffic and records what the client sends
+class FakeClient : public Client
+{
+public:
+    uint8_t input[512];
+    size_t inputLength;
+    size_t inputPos;
+    uint8_t output[512];
+    size_t outputLength;
+    size_t writeCalls;
+    bool open;
+    bool failWrites;
+
+    FakeClient() : inputLength(0), inputPos(0), outputLength(0), writeCalls(0), open(false), failWrites(false) {}
+
+    void receive(const uint8_t *data, size_t length) {
+        memcpy(input + inputLength, data, length);
+        inputLength += length;
+    }
+
+    void clearOutput() {
+        outputLength = 0;
+        writeCalls = 0;
+    }
+
+    int connect(IPAddress ip, uint16_t port) { open = true; return 1; }
+    int connect(const char *host, uint16_t port) { open = true; return 1; }
+#if defined(ESP32)
+    int connect(IPAddress ip, uint16_t port, int32_t timeout) { open = true; return 1; }
+    int connect(const char *host, uint16_t port, int32_t timeout) { open = true; return 1; }
+#endif
+    size_t write(uint8_t b) { return write(&b, 1); }
+    size_t write(const uint8_t *data, size_t size) {
+        if (failWrites) {
+            return 0;
+        }
+        memcpy(output + outputLength, data, size);
+        outputLength += size;
+        writeCalls++;
+        return size;
+    }
+    int available() { return inputLength - inputPos; }
+    int read() { return inputPos < inputLength ? input[inputPos++] : -1; }
+    int read(uint8_t *data, size_t size) {
+        size_t count = 0;
+        while (count < size && inputPos < inputLength) {
+            data[count++] = input[inputPos++];
+        }
+        return count;
+    }
+    int peek() { return inputPos < inputLength ? input[inputPos] : -1; }
+    void flush() {}
+    void stop() { open = false; }
+    uint8_t connected() { return open; }
+    operator bool() { return open; }
+};
+
+static char receivedTopic[64];
+static char receivedPayload[64];
+static int receivedCount;
+
+static void onMessage(char *topic, uint8_t *payload, unsigned int length) {
+    strncpy(receivedTopic, topic, sizeof(receivedTopic) - 1);
+    memcpy(receivedPayload, payload, length);
+    receivedPayload[length] = 0;
+    receivedCount++;
+}
+
+// CONNACK: session present, success, topic alias maximum 5, maximum packet size 1000
+static const uint8_t CONNACK_WITH_ALIASES[] = { 0x20, 0x0b, 0x01, 0x00, 0x08, 0x22, 0x00, 0x05, 0x27, 0x00, 0x00, 0x03, 0xe8 };
+
+static void connectClient(FakeClient &client, FastIoTMqtt5 &mqtt, const uint8_t *connack, size_t length) {
+    mqtt.setServer("broker", 1883);
+    mqtt.setCallback(onMessage);
+    client.receive(connack, length);
+    TEST_ASSERT_TRUE(mqtt.connect("id", "u", "p"));
+    client.clearOutput();
+}
+
+void test_connect_announces_session_and_limits() {
+    FakeClient client;
+    FastIoTMqtt5 mqtt(client);
+    mqtt.setServer("broker", 1883);
+    mqtt.setSessionExpiry(300);
+    client.receive(CONNACK_WITH_ALIASES, sizeof(CONNACK_WITH_ALIASES));
+
+    TEST_ASSERT_TRUE(mqtt.connect("id", "u", "p"));
+    TEST_ASSERT_EQUAL(FastIoTMqtt5::CONNECTED, mqtt.state());
+    TEST_ASSERT_TRUE(mqtt.sessionPresent());
+
+    // Clean start off, keep alive 15, session expiry 300, receive maximum 8,
+    // maximum packet size 256, topic alias maximum 2
+    const uint8_t expected[] = {
+        0x10, 0x25, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x05, 0xc0, 0x00, 0x0f,
+        0x10, 0x11, 0x00, 0x00, 0x01, 0x2c, 0x21, 0x00, 0x08, 0x27, 0x00, 0x00, 0x01, 0x00, 0x22, 0x00, 0x02,
+        0x00, 0x02, 'i', 'd', 0x00, 0x01, 'u', 0x00, 0x01, 'p'
+    };
+    TEST_ASSERT_EQUAL(sizeof(expected), client.outputLength);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, client.output, sizeof(expected));
+}
+
+void test_connect_reports_refusal_reason() {
+    FakeClient client;
+    FastIoTMqtt5 mqtt(client);
+    mqtt.setServer("broker", 1883);
+    const uint8_t connack[] = { 0x20, 0x03, 0x00, 0x87, 0x00 };  // not authorized
+    client.receive(connack, sizeof(connack));
+
+    TEST_ASSERT_FALSE(mqtt.connect("id", "u", "p"));
+    TEST_ASSERT_EQUAL(0x87, mqtt.state());
+    TEST_ASSERT_FALSE(client.open);
+}
+
+void test_subscribe_qos1() {
+    FakeClient client;
+    FastIoTMqtt5 mqtt(client);
+    connectClient(client, mqtt, CONNACK_WITH_ALIASES, sizeof(CONNACK_WITH_ALIASES));
+
+    TEST_ASSERT_TRUE(mqtt.subscribe("device/1", 1));
+    const uint8_t expected[] = { 0x82, 0x0e, 0x00, 0x01, 0x00, 0x00, 0x08, 'd', 'e', 'v', 'i', 'c', 'e', '/', '1', 0x01 };
+    TEST_ASSERT_EQUAL(sizeof(expected), client.outputLength);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, client.output, sizeof(expected));
+}
+
+void test_publish_replaces_topic_with_alias() {
+    FakeClient client;
+    FastIoTMqtt5 mqtt(client);
+    connectClient(client, mqtt, CONNACK_WITH_ALIASES, sizeof(CONNACK_WITH_ALIASES));
+
+    // First publish sets up alias 1 next to the full topic
+    TEST_ASSERT_TRUE(mqtt.publish("device/1/update", "{\"a\":1}"));
+    const uint8_t first[] = {
+        0x30, 0x1c, 0x00, 0x0f, 'd', 'e', 'v', 'i', 'c', 'e', '/', '1', '/', 'u', 'p', 'd', 'a', 't', 'e',
+        0x03, 0x23, 0x00, 0x01, '{', '"', 'a', '"', ':', '1', '}'
+    };
+    TEST_ASSERT_EQUAL(sizeof(first), client.outputLength);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(first, client.output, sizeof(first));
+
+    // Later ones send an empty topic and the alias only
+    client.clearOutput();
+    TEST_ASSERT_TRUE(mqtt.publish("device/1/update", "{\"a\":2}"));
+    const uint8_t second[] = { 0x30, 0x0d, 0x00, 0x00, 0x03, 0x23, 0x00, 0x01, '{', '"', 'a', '"', ':', '2', '}' };
+    TEST_ASSERT_EQUAL(sizeof(second), client.outputLength);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(second, client.output, sizeof(second));
+}
+
+void test_failed_publish_does_not_claim_alias() {
+    FakeClient client;
+    FastIoTMqtt5 mqtt(client);
+    connectClient(client, mqtt, CONNACK_WITH_ALIASES, sizeof(CONNACK_WITH_ALIASES));
+
+    client.failWrites = true;
+    TEST_ASSERT_FALSE(mqtt.publish("t", "x"));
+    client.failWrites = false;
+
+    // The broker never saw alias 1 bound to the topic, so it is sent again
+    TEST_ASSERT_TRUE(mqtt.publish("t", "x"));
+    const uint8_t expected[] = { 0x30, 0x08, 0x00, 0x01, 't', 0x03, 0x23, 0x00, 0x01, 'x' };
+    TEST_ASSERT_EQUAL(sizeof(expected), client.outputLength);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, client.output, sizeof(expected));
+}
+
+void test_publish_without_broker_aliases() {
+    FakeClient client;
+    FastIoTMqtt5 mqtt(client);
+    const uint8_t connack[] = { 0x20, 0x03, 0x00, 0x00, 0x00 };
+    connectClient(client, mqtt, connack, sizeof(connack));
+
+    TEST_ASSERT_TRUE(mqtt.publish("t", "x"));
+    TEST_ASSERT_TRUE(mqtt.publish("t", "x"));
+    const uint8_t expected[] = { 0x30, 0x05, 0x00, 0x01, 't', 0x00, 'x', 0x30, 0x05, 0x00, 0x01, 't', 0x00, 'x' };
+    TEST_ASSERT_EQUAL(sizeof(expected), client.outputLength);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, client.output, sizeof(expected));
+}
+
+void test_inbound_aliases_and_batched_pubacks() {
+    FakeClient client;
+    FastIoTMqtt5 mqtt(client);
+    connectClient(client, mqtt, CONNACK_WITH_ALIASES, sizeof(CONNACK_WITH_ALIASES));
+    receivedCount = 0;
+
+    // QoS 1 id 7 sets inbound alias 1, QoS 1 id 8 uses it without a topic
+    const uint8_t publishes[] = {
+        0x32, 0x12, 0x00, 0x08, 'd', 'e', 'v', 'i', 'c', 'e', '/', '1', 0x00, 0x07, 0x03, 0x23, 0x00, 0x01, 'h', 'i',
+        0x32, 0x0a, 0x00, 0x00, 0x00, 0x08, 0x03, 0x23, 0x00, 0x01, 'y', 'o'
+    };
+    client.receive(publishes, sizeof(publishes));
+    TEST_ASSERT_TRUE(mqtt.loop());
+
+    TEST_ASSERT_EQUAL(2, receivedCount);
+    TEST_ASSERT_EQUAL_STRING("device/1", receivedTopic);
+    TEST_ASSERT_EQUAL_STRING("yo", receivedPayload);
+
+    // Both acknowledgements go out in one write
+    const uint8_t acks[] = { 0x40, 0x02, 0x00, 0x07, 0x40, 0x02, 0x00, 0x08 };
+    TEST_ASSERT_EQUAL(1, client.writeCalls);
+    TEST_ASSERT_EQUAL(sizeof(acks), client.outputLength);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(acks, client.output, sizeof(acks));
+}
+
+void test_unknown_inbound_alias_is_dropped() {
+    FakeClient client;
+    FastIoTMqtt5 mqtt(client);
+    connectClient(client, mqtt, CONNACK_WITH_ALIASES, sizeof(CONNACK_WITH_ALIASES));
+    receivedCount = 0;
+
+    // QoS 1 id 5 with an empty topic and no alias, then id 6 with alias 3 (above our maximum of 2)
+    const uint8_t publishes[] = {
+        0x32, 0x06, 0x00, 0x00, 0x00, 0x05, 0x00, 'a',
+        0x32, 0x09, 0x00, 0x00, 0x00, 0x06, 0x03, 0x23, 0x00, 0x03, 'b'
+    };
+    client.receive(publishes, sizeof(publishes));
+    TEST_ASSERT_TRUE(mqtt.loop());
+
+    TEST_ASSERT_EQUAL(0, receivedCount);
+    const uint8_t acks[] = { 0x40, 0x02, 0x00, 0x05, 0x40, 0x02, 0x00, 0x06 };
+    TEST_ASSERT_EQUAL(sizeof(acks), client.outputLength);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(acks, client.output, sizeof(acks));
+}
+
+void test_oversized_topic_is_still_acknowledged() {
+    FakeClient client;
+    FastIoTMqtt5 mqtt(client);
+    connectClient(client, mqtt, CONNACK_WITH_ALIASES, sizeof(CONNACK_WITH_ALIASES));
+    receivedCount = 0;
+
+    // QoS 1 id 9 with a 300 byte topic, longer than the packet buffer
+    uint8_t publish[310];
+    size_t length = 0;
+    publish[length++] = 0x32;
+    publish[length++] = 0xb3;  // remaining length 307
+    publish[length++] = 0x02;
+    publish[length++] = 0x01;
+    publish[length++] = 0x2c;
+    for (int i = 0; i < 300; i++) {
+        publish[length++] = 'a';
+    }
+    publish[length++] = 0x00;
+    publish[length++] = 0x09;
+    publish[length++] = 0x00;
+    publish[length++] = 'x';
+    publish[length++] = 'y';
+    client.receive(publish, length);
+    TEST_ASSERT_TRUE(mqtt.loop());
+
+    TEST_ASSERT_EQUAL(0, receivedCount);
+    const uint8_t ack[] = { 0x40, 0x02, 0x00, 0x09 };
+    TEST_ASSERT_EQUAL(sizeof(ack), client.outputLength);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(ack, client.output, sizeof(ack));
+}
+
+void test_disconnect() {
+    FakeClient client;
+    FastIoTMqtt5 mqtt(client);
+    connectClient(client, mqtt, CONNACK_WITH_ALIASES, sizeof(CONNACK_WITH_ALIASES));
+
+    mqtt.disconnect();
+    const uint8_t expected[] = { 0xe0, 0x00 };
+    TEST_ASSERT_EQUAL(sizeof(expected), client.outputLength);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, client.output, sizeof(expected));
+    TEST_ASSERT_FALSE(mqtt.connected());
+}
+
+void setup() {
+    // Give the serial monitor time to attach
+    delay(2000);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_connect_announces_session_and_limits);
+    RUN_TEST(test_connect_reports_refusal_reason);
+    RUN_TEST(test_subscribe_qos1);
+    RUN_TEST(test_publish_replaces_topic_with_alias);
+    RUN_TEST(test_failed_publish_does_not_claim_alias);
+    RUN_TEST(test_publish_without_broker_aliases);
+    RUN_TEST(test_inbound_aliases_and_batched_pubacks);
+    RUN_TEST(test_unknown_inbound_alias_is_dropped);
+    RUN_TEST(test_oversized_topic_is_still_acknowledged);
+    RUN_TEST(test_disconnect);
+    UNITY_END();
+}
+
+void loop() {
+}